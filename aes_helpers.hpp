@@ -1,19 +1,44 @@
 #include <openssl/aes.h>
 #include <openssl/evp.h>
 #include <openssl/err.h>
+#include <openssl/rand.h>
 #include <cstring>
+#include <algorithm>
+#include "thread_pool.hpp"
 
-void handleErrors(void)
+// EVP update calls take int lengths, larger buffers are fed in chunks of this size
+const size_t EVP_CHUNK_SIZE = 1 << 30;
+
+// smallest CTR range handed to one thread
+const size_t CTR_PARALLEL_GRAIN = 1 << 20;
+
+// one cipher context per thread, reset and re-keyed for every range instead of
+// allocated per call
+struct CipherContext {
+    EVP_CIPHER_CTX* ctx = EVP_CIPHER_CTX_new();
+    ~CipherContext() { EVP_CIPHER_CTX_free(ctx); }
+};
+
+inline EVP_CIPHER_CTX* threadCipherContext()
 {
-    ERR_print_errors_fp(stderr);
-    abort();
+    thread_local CipherContext context;
+    if (context.ctx != NULL) {
+        EVP_CIPHER_CTX_reset(context.ctx);
+    }
+    return context.ctx;
 }
 
-int encrypt(std::vector<unsigned char>& plaintext, int plaintext_len, unsigned char *key,
-            unsigned char *iv, std::vector<unsigned char>& ciphertext)
+// print the OpenSSL error queue, release ctx and report failure
+inline int handleErrors(EVP_CIPHER_CTX *ctx)
 {
-    int k_len = strlen((const char*)key), plaintext_length = static_cast<int>(plaintext.size());
+    ERR_print_errors_fp(stderr);
+    EVP_CIPHER_CTX_free(ctx);
+    return -1;
+}
 
+inline int encrypt(std::vector<unsigned char>& plaintext, size_t plaintext_len, const unsigned char *key,
+            const unsigned char *iv, std::vector<unsigned char>& ciphertext)
+{
     EVP_CIPHER_CTX *en;
     en = EVP_CIPHER_CTX_new();
 
@@ -33,17 +58,24 @@ int encrypt(std::vector<unsigned char>& plaintext, int plaintext_len, unsigned c
         return -1; // Return an error code
     }
 
-    int c_len = plaintext_length + AES_BLOCK_SIZE, f_len = 0;
-    ciphertext.resize(c_len);
+    size_t c_len = 0;
+    int f_len = 0;
+    ciphertext.resize(plaintext_len + AES_BLOCK_SIZE);
 
     /*
      * Provide the message to be encrypted, and obtain the encrypted output.
-     * EVP_EncryptUpdate can be called multiple times if necessary
+     * EVP_EncryptUpdate is called once per chunk so payloads past 2 GiB fit its int lengths
      */
-    if (1 != EVP_EncryptUpdate(en, ciphertext.data(), &c_len, plaintext.data(), plaintext_len)) {
-        fprintf(stderr, "Error: EVP_EncryptUpdate() failed.\n");
-        EVP_CIPHER_CTX_free(en);
-        return -1; // Return an error code
+    for (size_t offset = 0; offset < plaintext_len; offset += EVP_CHUNK_SIZE) {
+        int chunk = static_cast<int>(std::min(plaintext_len - offset, EVP_CHUNK_SIZE));
+        int out_len = 0;
+
+        if (1 != EVP_EncryptUpdate(en, ciphertext.data() + c_len, &out_len, plaintext.data() + offset, chunk)) {
+            fprintf(stderr, "Error: EVP_EncryptUpdate() failed.\n");
+            EVP_CIPHER_CTX_free(en);
+            return -1; // Return an error code
+        }
+        c_len += out_len;
     }
 
     /*
@@ -64,25 +96,34 @@ int encrypt(std::vector<unsigned char>& plaintext, int plaintext_len, unsigned c
     return f_len;
 }
 
-int decrypt(std::vector<unsigned char>& ciphertext, int ciphertext_len, unsigned char *key,
-            unsigned char *iv, std::vector<unsigned char>& plaintext)
+inline int decrypt(std::vector<unsigned char>& ciphertext, size_t ciphertext_len, const unsigned char *key,
+            const unsigned char *iv, std::vector<unsigned char>& plaintext)
 {
     EVP_CIPHER_CTX *ctx;
-    int k_len = strlen((const char *)key);
-    int p_len = static_cast<int>(plaintext.size()), f_len = 0;
+    size_t p_len = 0;
+    int f_len = 0;
 
     if (!(ctx = EVP_CIPHER_CTX_new())) {
-        handleErrors();
+        return handleErrors(ctx);
     }
 
     EVP_CIPHER_CTX_init(ctx);
 
     if (1 != EVP_DecryptInit_ex(ctx, EVP_aes_256_cbc(), NULL, key, iv)) {
-        handleErrors();
+        return handleErrors(ctx);
     }
 
-    if (1 != EVP_DecryptUpdate(ctx, plaintext.data(), &p_len, ciphertext.data(), p_len)) {
-        handleErrors();
+    // the plaintext is never longer than the ciphertext, its exact length is known after the final block
+    plaintext.resize(ciphertext_len);
+
+    for (size_t offset = 0; offset < ciphertext_len; offset += EVP_CHUNK_SIZE) {
+        int chunk = static_cast<int>(std::min(ciphertext_len - offset, EVP_CHUNK_SIZE));
+        int out_len = 0;
+
+        if (1 != EVP_DecryptUpdate(ctx, plaintext.data() + p_len, &out_len, ciphertext.data() + offset, chunk)) {
+            return handleErrors(ctx);
+        }
+        p_len += out_len;
     }
 
     if (1 != EVP_DecryptFinal_ex(ctx, plaintext.data() + p_len, &f_len)) {
@@ -92,13 +133,73 @@ int decrypt(std::vector<unsigned char>& ciphertext, int ciphertext_len, unsigned
         return -1; // Indicate decryption failure
     }
 
+    plaintext.erase(plaintext.begin() + p_len + f_len, plaintext.end());
+
     EVP_CIPHER_CTX_free(ctx);
 
     return f_len;
 }
 
-int encrypt_seed(unsigned char *plaintext, int plaintext_len, unsigned char *key,
-            unsigned char *iv, unsigned char *ciphertext)
+// counter block `blocks` AES blocks past iv, read as a 128-bit big endian integer
+// the same way EVP increments it
+inline void ctrCounterAt(const unsigned char* iv, unsigned long long blocks, unsigned char* counter)
+{
+    std::memcpy(counter, iv, AES_BLOCK_SIZE);
+
+    for (int i = AES_BLOCK_SIZE - 1; i >= 0 && blocks != 0; --i) {
+        unsigned long long sum = counter[i] + (blocks & 0xFF);
+        counter[i] = static_cast<unsigned char>(sum);
+        blocks = (blocks >> 8) + (sum >> 8);
+    }
+}
+
+/*
+ * AES-256-CTR over length bytes. Every block of keystream depends only on its
+ * counter, so ranges are encrypted independently across the pool and the result
+ * matches a single EVP pass. Encryption and decryption are the same operation,
+ * out may equal in.
+ */
+inline bool ctr_crypt(const unsigned char* in, size_t length, const unsigned char* key,
+               const unsigned char* iv, unsigned char* out, ThreadPool& pool)
+{
+    std::atomic<bool> failed(false);
+    unsigned long long blocks = (length + AES_BLOCK_SIZE - 1) / AES_BLOCK_SIZE;
+
+    pool.parallelFor(blocks, CTR_PARALLEL_GRAIN / AES_BLOCK_SIZE, [&](unsigned long long first, unsigned long long last) {
+        size_t begin = first * AES_BLOCK_SIZE;
+        size_t end = std::min<size_t>(length, last * AES_BLOCK_SIZE);
+
+        unsigned char counter[AES_BLOCK_SIZE];
+        ctrCounterAt(iv, first, counter);
+
+        EVP_CIPHER_CTX *ctx = threadCipherContext();
+        if (ctx == NULL || 1 != EVP_EncryptInit_ex(ctx, EVP_aes_256_ctr(), NULL, key, counter)) {
+            failed = true;
+            return;
+        }
+
+        for (size_t offset = begin; offset < end; offset += EVP_CHUNK_SIZE) {
+            int chunk = static_cast<int>(std::min(end - offset, EVP_CHUNK_SIZE));
+            int out_len = 0;
+
+            if (1 != EVP_EncryptUpdate(ctx, out + offset, &out_len, in + offset, chunk)) {
+                failed = true;
+                break;
+            }
+        }
+    });
+
+    if (failed) {
+        ERR_print_errors_fp(stderr);
+        fprintf(stderr, "Error: AES-256-CTR failed.\n");
+        return false;
+    }
+
+    return true;
+}
+
+inline int encrypt_seed(const unsigned char *plaintext, int plaintext_len, const unsigned char *key,
+            const unsigned char *iv, unsigned char *ciphertext)
 {
     EVP_CIPHER_CTX *ctx;
 
@@ -108,7 +209,7 @@ int encrypt_seed(unsigned char *plaintext, int plaintext_len, unsigned char *key
 
     /* Create and initialise the context */
     if(!(ctx = EVP_CIPHER_CTX_new()))
-        handleErrors();
+        return handleErrors(ctx);
 
     /*
      * Initialise the encryption operation. IMPORTANT - ensure you use a key
@@ -118,14 +219,14 @@ int encrypt_seed(unsigned char *plaintext, int plaintext_len, unsigned char *key
      * is 128 bits
      */
     if(1 != EVP_EncryptInit_ex(ctx, EVP_aes_256_cbc(), NULL, key, iv))
-        handleErrors();
+        return handleErrors(ctx);
 
     /*
      * Provide the message to be encrypted, and obtain the encrypted output.
      * EVP_EncryptUpdate can be called multiple times if necessary
      */
     if(1 != EVP_EncryptUpdate(ctx, ciphertext, &len, plaintext, plaintext_len))
-        handleErrors();
+        return handleErrors(ctx);
     ciphertext_len = len;
 
     /*
@@ -133,7 +234,7 @@ int encrypt_seed(unsigned char *plaintext, int plaintext_len, unsigned char *key
      * this stage.
      */
     if(1 != EVP_EncryptFinal_ex(ctx, ciphertext + len, &len))
-        handleErrors();
+        return handleErrors(ctx);
     ciphertext_len += len;
 
     /* Clean up */
@@ -142,8 +243,8 @@ int encrypt_seed(unsigned char *plaintext, int plaintext_len, unsigned char *key
     return ciphertext_len;
 }
 
-int decrypt_seed(unsigned char *ciphertext, int ciphertext_len, unsigned char *key,
-            unsigned char *iv, unsigned char *plaintext)
+inline int decrypt_seed(const unsigned char *ciphertext, int ciphertext_len, const unsigned char *key,
+            const unsigned char *iv, unsigned char *plaintext)
 {
     EVP_CIPHER_CTX *ctx;
 
@@ -153,7 +254,7 @@ int decrypt_seed(unsigned char *ciphertext, int ciphertext_len, unsigned char *k
 
     /* Create and initialise the context */
     if(!(ctx = EVP_CIPHER_CTX_new()))
-        handleErrors();
+        return handleErrors(ctx);
 
     /*
      * Initialise the decryption operation. IMPORTANT - ensure you use a key
@@ -163,14 +264,14 @@ int decrypt_seed(unsigned char *ciphertext, int ciphertext_len, unsigned char *k
      * is 128 bits
      */
     if(1 != EVP_DecryptInit_ex(ctx, EVP_aes_256_cbc(), NULL, key, iv))
-        handleErrors();
+        return handleErrors(ctx);
 
     /*
      * Provide the message to be decrypted, and obtain the plaintext output.
      * EVP_DecryptUpdate can be called multiple times if necessary.
      */
     if(1 != EVP_DecryptUpdate(ctx, plaintext, &len, ciphertext, ciphertext_len))
-        handleErrors();
+        return handleErrors(ctx);
     plaintext_len = len;
 
     /*
@@ -178,7 +279,7 @@ int decrypt_seed(unsigned char *ciphertext, int ciphertext_len, unsigned char *k
      * this stage.
      */
     if(1 != EVP_DecryptFinal_ex(ctx, plaintext + len, &len))
-        handleErrors();
+        return handleErrors(ctx);
     plaintext_len += len;
 
     /* Clean up */
@@ -0,0 +1,298 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <map>
+#include <cctype>
+#include "librsteg.hpp"
+
+// Batch manifests, one job per line, blank lines and lines starting with # skipped.
+//
+//  CSV   : enc,<container>,<embed file>,<output container>
+//          dec,<container>,<output base>
+//          fields may be double quoted, a leading "mode,..." header is ignored
+//  JSONL : {"mode": "enc", "input": "...", "embed": "...", "output": "..."}
+//          {"mode": "dec", "input": "...", "output": "..."}
+
+bool splitCsvLine(const std::string& line, std::vector<std::string>& fields) {
+    fields.assign(1, std::string());
+    bool quoted = false;
+
+    for (size_t i = 0; i < line.size(); ++i) {
+        char c = line[i];
+        if (quoted) {
+            if (c == '"' && i + 1 < line.size() && line[i + 1] == '"') {
+                fields.back() += '"';
+                ++i;
+            } else if (c == '"') {
+                quoted = false;
+            } else {
+                fields.back() += c;
+            }
+        } else if (c == '"') {
+            quoted = true;
+        } else if (c == ',') {
+            fields.emplace_back();
+        } else if (c != '\r') {
+            fields.back() += c;
+        }
+    }
+
+    return !quoted;
+}
+
+// code point of a \uXXXX escape, as UTF-8
+void appendUtf8(std::string& out, unsigned long code) {
+    if (code < 0x80) {
+        out += static_cast<char>(code);
+    } else if (code < 0x800) {
+        out += static_cast<char>(0xC0 | code >> 6);
+        out += static_cast<char>(0x80 | (code & 0x3F));
+    } else if (code < 0x10000) {
+        out += static_cast<char>(0xE0 | code >> 12);
+        out += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+        out += static_cast<char>(0x80 | (code & 0x3F));
+    } else {
+        out += static_cast<char>(0xF0 | code >> 18);
+        out += static_cast<char>(0x80 | ((code >> 12) & 0x3F));
+        out += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+        out += static_cast<char>(0x80 | (code & 0x3F));
+    }
+}
+
+// flat object of string, number and literal values, enough for manifest lines
+// and daemon replies; non-string values are kept as written
+bool parseJsonLine(const std::string& line, std::map<std::string, std::string>& object) {
+    size_t i = 0;
+    auto skipSpace = [&] {
+        while (i < line.size() && isspace(static_cast<unsigned char>(line[i]))) {
+            ++i;
+        }
+    };
+    // four hex digits after line[i], i is left on the last one
+    auto readHex = [&](unsigned long& code) {
+        if (i + 4 >= line.size()) {
+            return false;
+        }
+        for (int digit = 0; digit < 4; ++digit) {
+            char c = line[++i];
+            int value = c >= '0' && c <= '9' ? c - '0' : c >= 'a' && c <= 'f' ? c - 'a' + 10 : c >= 'A' && c <= 'F' ? c - 'A' + 10 : -1;
+            if (value < 0) {
+                return false;
+            }
+            code = code << 4 | static_cast<unsigned long>(value);
+        }
+        return true;
+    };
+
+    auto readString = [&](std::string& out) {
+        skipSpace();
+        if (i >= line.size() || line[i] != '"') {
+            return false;
+        }
+        for (++i; i < line.size(); ++i) {
+            if (line[i] == '"') {
+                ++i;
+                return true;
+            }
+            if (line[i] == '\\' && i + 1 < line.size()) {
+                char e = line[++i];
+                if (e == 'u') {
+                    unsigned long code = 0;
+                    if (!readHex(code)) {
+                        return false;
+                    }
+                    // a surrogate pair spells one code point past the BMP
+                    if (code >= 0xD800 && code < 0xDC00 && line.compare(i + 1, 2, "\\u") == 0) {
+                        i += 2;
+                        unsigned long low = 0;
+                        if (!readHex(low) || low < 0xDC00 || low >= 0xE000) {
+                            return false;
+                        }
+                        code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+                    }
+                    appendUtf8(out, code);
+                } else {
+                    out += e == 'n' ? '\n' : e == 't' ? '\t' : e == 'r' ? '\r' : e == 'b' ? '\b' : e == 'f' ? '\f' : e;
+                }
+            } else {
+                out += line[i];
+            }
+        }
+        return false;
+    };
+
+    skipSpace();
+    if (i >= line.size() || line[i++] != '{') {
+        return false;
+    }
+
+    skipSpace();
+    if (i < line.size() && line[i] == '}') {
+        return true;
+    }
+
+    while (true) {
+        std::string key, value;
+        if (!readString(key)) {
+            return false;
+        }
+        skipSpace();
+        if (i >= line.size() || line[i++] != ':') {
+            return false;
+        }
+        skipSpace();
+        if (i < line.size() && line[i] != '"') {
+            while (i < line.size() && line[i] != ',' && line[i] != '}' && !isspace(static_cast<unsigned char>(line[i]))) {
+                value += line[i++];
+            }
+            if (value.empty()) {
+                return false;
+            }
+        } else if (!readString(value)) {
+            return false;
+        }
+        object[key] = value;
+
+        skipSpace();
+        if (i < line.size() && line[i] == ',') {
+            ++i;
+            continue;
+        }
+        return i < line.size() && line[i] == '}';
+    }
+}
+
+bool parseJobMode(const std::string& mode, RstegJobMode& jobMode) {
+    if (mode == "enc") {
+        jobMode = RSTEG_JOB_EMBED;
+    } else if (mode == "dec") {
+        jobMode = RSTEG_JOB_EXTRACT;
+    } else {
+        return false;
+    }
+
+    return true;
+}
+
+// one JSONL job, as found in manifests and daemon requests
+bool parseJobJson(const std::string& line, RstegJob& job) {
+    std::map<std::string, std::string> object;
+    if (!parseJsonLine(line, object)) {
+        return false;
+    }
+
+    job.container = object.count("input") ? object["input"] : object["container"];
+    job.payload = object.count("embed") ? object["embed"] : object["payload"];
+    job.output = object["output"];
+
+    return parseJobMode(object["mode"], job.mode);
+}
+
+bool jobComplete(const RstegJob& job) {
+    return !job.container.empty() && !job.output.empty() && (job.mode == RSTEG_JOB_EXTRACT || !job.payload.empty());
+}
+
+bool readManifest(const char* path, std::vector<RstegJob>& jobs) {
+    std::ifstream manifest(path);
+    if (!manifest.is_open()) {
+        std::cerr << "Error:    unable to read manifest " << path << std::endl;
+        return false;
+    }
+
+    std::string line;
+    int lineNumber = 0;
+    while (std::getline(manifest, line)) {
+        ++lineNumber;
+
+        size_t first = line.find_first_not_of(" \t\r");
+        if (first == std::string::npos || line[first] == '#') {
+            continue;
+        }
+
+        RstegJob job;
+        bool valid = true;
+
+        if (line[first] == '{') {
+            valid = parseJobJson(line, job);
+        } else {
+            std::vector<std::string> fields;
+            valid = splitCsvLine(line, fields);
+            std::string mode = fields[0];
+            if (mode == "mode" && jobs.empty()) {
+                continue;
+            }
+            bool embed = mode == "enc";
+            valid = valid && fields.size() == (embed ? 4u : 3u) && parseJobMode(mode, job.mode);
+            if (valid) {
+                job.container = fields[1];
+                job.payload = embed ? fields[2] : std::string();
+                job.output = fields.back();
+            }
+        }
+
+        valid = valid && jobComplete(job);
+        if (!valid) {
+            std::cerr << "Error:    invalid manifest entry at line " << lineNumber << std::endl;
+            return false;
+        }
+
+        jobs.push_back(job);
+    }
+
+    if (jobs.empty()) {
+        std::cerr << "Error:    manifest has no jobs" << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+std::string jsonEscape(const std::string& text) {
+    std::ostringstream out;
+    for (unsigned char c : text) {
+        if (c == '"' || c == '\\') {
+            out << '\\' << c;
+        } else if (c < 0x20) {
+            out << "\\u" << std::hex << std::setw(4) << std::setfill('0') << static_cast<int>(c) << std::dec;
+        } else {
+            out << c;
+        }
+    }
+    return out.str();
+}
+
+// summary line of a single job, also the daemon's reply
+void writeJobResult(std::ostream& out, unsigned long long number, const RstegJob& job, const RstegJobResult& result) {
+    out << std::fixed << std::setprecision(3)
+        << "{\"job\":" << number
+        << ",\"mode\":\"" << (job.mode == RSTEG_JOB_EMBED ? "enc" : "dec") << "\""
+        << ",\"input\":\"" << jsonEscape(job.container) << "\""
+        << ",\"output\":\"" << jsonEscape(result.outputPath) << "\""
+        << ",\"ok\":" << (result.status == RSTEG_OK ? "true" : "false")
+        << ",\"status\":" << static_cast<int>(result.status)
+        << ",\"error\":\"" << (result.status == RSTEG_OK ? "" : rstegStatusMessage(result.status)) << "\""
+        << ",\"ms\":" << result.seconds * 1000.0 << "}\n";
+}
+
+// JSONL summary : one object per job in manifest order, then a totals object
+void writeBatchSummary(std::ostream& out, const std::vector<RstegJob>& jobs, const std::vector<RstegJobResult>& results,
+                       double seconds, unsigned int threads, unsigned int runners) {
+    size_t failed = 0;
+
+    for (size_t i = 0; i < jobs.size(); ++i) {
+        if (results[i].status != RSTEG_OK) {
+            ++failed;
+        }
+        writeJobResult(out, i + 1, jobs[i], results[i]);
+    }
+
+    out << "{\"summary\":true,\"jobs\":" << jobs.size()
+        << ",\"passed\":" << jobs.size() - failed
+        << ",\"failed\":" << failed
+        << ",\"threads\":" << threads
+        << ",\"concurrency\":" << runners
+        << ",\"ms\":" << seconds * 1000.0 << "}" << std::endl;
+}
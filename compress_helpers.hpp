@@ -0,0 +1,344 @@
+#include <vector>
+#include <string>
+#include <cstring>
+#include <functional>
+#include <zlib.h>
+#include "thread_pool.hpp"
+#include "stats_helpers.hpp"
+
+#ifdef RSTEG_WITH_ZSTD
+#include <zstd.h>
+#endif
+
+// Optional payload compression ahead of the cipher. zlib streams are deflated in
+// parallel bands like PNG IDAT data, zstd uses its own worker threads. Extraction
+// inflates the decrypted segments as they arrive.
+
+const size_t COMPRESS_BAND_BYTES = 1 << 20;
+const size_t COMPRESS_SAMPLE_BYTES = 256 * 1024;
+const size_t INFLATE_CHUNK_BYTES = 1 << 20;
+
+inline bool parseCompression(const std::string& name, unsigned char& compression) {
+    if (name == "none") {
+        compression = PAYLOAD_COMPRESSION_NONE;
+    } else if (name == "zlib") {
+        compression = PAYLOAD_COMPRESSION_ZLIB;
+    } else if (name == "zstd") {
+        compression = PAYLOAD_COMPRESSION_ZSTD;
+    } else {
+        return false;
+    }
+
+    return true;
+}
+
+inline bool compressionAvailable(unsigned char compression) {
+#ifdef RSTEG_WITH_ZSTD
+    return compression <= PAYLOAD_COMPRESSION_ZSTD;
+#else
+    return compression <= PAYLOAD_COMPRESSION_ZLIB;
+#endif
+}
+
+// valid level range, -1 picks the backend default
+inline bool compressionLevelValid(unsigned char compression, int level) {
+    if (level == -1) {
+        return true;
+    }
+#ifdef RSTEG_WITH_ZSTD
+    if (compression == PAYLOAD_COMPRESSION_ZSTD) {
+        return level >= 1 && level <= ZSTD_maxCLevel();
+    }
+#endif
+    return compression != PAYLOAD_COMPRESSION_ZLIB || (level >= 0 && level <= 9);
+}
+
+// formats that are compressed already, recognized by their magic bytes
+inline bool looksCompressed(const unsigned char* data, size_t size) {
+    auto starts = [&](const char* magic, size_t length, size_t offset = 0) {
+        return size >= offset + length && memcmp(data + offset, magic, length) == 0;
+    };
+
+    return starts("PK\x03\x04", 4) ||                       // zip, docx, jar, apk
+           starts("\xFF\xD8\xFF", 3) ||                     // jpeg
+           starts("\x89PNG", 4) ||
+           starts("GIF8", 4) ||
+           starts("ID3", 3) || starts("\xFF\xFB", 2) || starts("\xFF\xF3", 2) ||   // mp3
+           starts("\x1F\x8B", 2) ||                         // gzip
+           starts("\x28\xB5\x2F\xFD", 4) ||                 // zstd
+           starts("\xFD" "7zXZ", 5) ||                      // xz
+           starts("BZh", 3) ||
+           starts("7z\xBC\xAF\x27\x1C", 6) ||
+           starts("Rar!", 4) ||
+           starts("OggS", 4) ||
+           starts("fLaC", 4) ||
+           starts("ftyp", 4, 4) ||                          // mp4, mov, heic
+           (starts("RIFF", 4) && starts("WEBP", 4, 8));
+}
+
+// Cheap admission test : skip known compressed formats, then deflate a leading
+// sample at level 1 and require it to shrink by a tenth.
+inline bool worthCompressing(const unsigned char* data, size_t size) {
+    if (size == 0 || looksCompressed(data, size)) {
+        return false;
+    }
+
+    size_t sampleSize = std::min(size, COMPRESS_SAMPLE_BYTES);
+    std::vector<unsigned char> sample;
+    if (!deflateBand(data, sampleSize, nullptr, 0, 1, true, sample)) {
+        return false;
+    }
+
+    return sample.size() * 10 < sampleSize * 9;
+}
+
+// zlib stream of `size` bytes, bands deflated across the pool and stitched
+// together the same way writePngBands does
+inline bool zlibCompress(const unsigned char* data, size_t size, int level, ThreadPool& pool, std::vector<unsigned char>& out) {
+    size_t bandBytes = std::max(COMPRESS_BAND_BYTES, (size + pool.size() - 1) / pool.size());
+    bandBytes = std::min<size_t>(bandBytes, 1 << 30);
+    size_t numBands = std::max<size_t>(1, (size + bandBytes - 1) / bandBytes);
+
+    std::vector<std::vector<unsigned char>> compressed(numBands);
+    std::vector<uLong> checksums(numBands);
+    std::vector<char> failed(numBands, 0);
+
+    pool.parallelFor(numBands, 1, [&](unsigned long long first, unsigned long long last) {
+        for (unsigned long long band = first; band < last; ++band) {
+            const unsigned char* start = data + band * bandBytes;
+            size_t length = std::min<size_t>(bandBytes, size - band * bandBytes);
+            size_t dictLength = std::min<size_t>(band * bandBytes, 32768);
+
+            checksums[band] = adler32(adler32(0L, Z_NULL, 0), start, static_cast<uInt>(length));
+            if (!deflateBand(start, length, start - dictLength, dictLength, level, band + 1 == numBands, compressed[band])) {
+                failed[band] = 1;
+            }
+        }
+    });
+
+    if (std::find(failed.begin(), failed.end(), 1) != failed.end()) {
+        return false;
+    }
+
+    uLong adler = checksums[0];
+    size_t total = 6;
+    for (size_t band = 0; band < numBands; ++band) {
+        if (band > 0) {
+            adler = adler32_combine(adler, checksums[band], static_cast<z_off_t>(std::min<size_t>(bandBytes, size - band * bandBytes)));
+        }
+        total += compressed[band].size();
+    }
+
+    out.resize(2);
+    zlibHeader(level, out.data());
+    out.reserve(total);
+    for (std::vector<unsigned char>& band : compressed) {
+        out.insert(out.end(), band.begin(), band.end());
+        std::vector<unsigned char>().swap(band);
+    }
+    out.insert(out.end(), {
+        static_cast<unsigned char>(adler >> 24), static_cast<unsigned char>(adler >> 16),
+        static_cast<unsigned char>(adler >> 8), static_cast<unsigned char>(adler)
+    });
+
+    return true;
+}
+
+#ifdef RSTEG_WITH_ZSTD
+inline bool zstdCompress(const unsigned char* data, size_t size, int level, unsigned int threads, std::vector<unsigned char>& out) {
+    ZSTD_CCtx* cctx = ZSTD_createCCtx();
+    if (cctx == nullptr) {
+        return false;
+    }
+
+    ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel, level < 0 ? ZSTD_CLEVEL_DEFAULT : level);
+    // single threaded libzstd builds reject this, compression then runs inline
+    if (threads > 1) {
+        ZSTD_CCtx_setParameter(cctx, ZSTD_c_nbWorkers, static_cast<int>(threads));
+    }
+
+    out.resize(ZSTD_compressBound(size));
+    size_t written = ZSTD_compress2(cctx, out.data(), out.size(), data, size);
+    ZSTD_freeCCtx(cctx);
+
+    if (ZSTD_isError(written)) {
+        return false;
+    }
+
+    out.resize(written);
+    return true;
+}
+#endif
+
+inline bool compressPayload(unsigned char compression, int level, const unsigned char* data, size_t size, ThreadPool& pool,
+                     std::vector<unsigned char>& out) {
+    StageTimer timer(STAGE_COMPRESS, size);
+
+    bool compressed = false;
+    if (compression == PAYLOAD_COMPRESSION_ZLIB) {
+        compressed = zlibCompress(data, size, level, pool, out);
+    }
+#ifdef RSTEG_WITH_ZSTD
+    if (compression == PAYLOAD_COMPRESSION_ZSTD) {
+        compressed = zstdCompress(data, size, level, pool.size(), out);
+    }
+#endif
+
+    if (!compressed) {
+        std::cerr << "Error:    unable to compress embed file" << std::endl;
+    }
+
+    return compressed;
+}
+
+// Streaming decompressor between the segment extractor and the output sink.
+// Decompressed bytes reach the sink in order, INFLATE_CHUNK_BYTES at a time.
+class PayloadInflater {
+public:
+    explicit PayloadInflater(unsigned char compression) : compression(compression) {}
+
+    ~PayloadInflater() {
+        if (zlibReady) {
+            inflateEnd(&strm);
+        }
+#ifdef RSTEG_WITH_ZSTD
+        if (dctx != nullptr) {
+            ZSTD_freeDCtx(dctx);
+        }
+#endif
+    }
+
+    PayloadInflater(const PayloadInflater&) = delete;
+    PayloadInflater& operator=(const PayloadInflater&) = delete;
+
+    bool write(const unsigned char* data, size_t size, const std::function<bool(const std::vector<unsigned char>&)>& sink) {
+        StageTimer timer(STAGE_DECOMPRESS, size);
+        if (finished && size > 0) {
+            std::cerr << "Error:    trailing data after the compressed payload" << std::endl;
+            return false;
+        }
+
+        if (compression == PAYLOAD_COMPRESSION_ZLIB) {
+            return inflateZlib(data, size, sink);
+        }
+#ifdef RSTEG_WITH_ZSTD
+        if (compression == PAYLOAD_COMPRESSION_ZSTD) {
+            return inflateZstd(data, size, sink);
+        }
+#endif
+
+        std::cerr << "Error:    payload compression not supported by this build" << std::endl;
+        return false;
+    }
+
+    // the compressed stream ended exactly on `expected` bytes
+    bool complete(unsigned long long expected) const {
+        return finished && produced == expected;
+    }
+
+private:
+    unsigned char compression;
+    std::vector<unsigned char> buffer;
+    unsigned long long produced = 0;
+    bool finished = false;
+
+    z_stream strm{};
+    bool zlibReady = false;
+
+#ifdef RSTEG_WITH_ZSTD
+    ZSTD_DCtx* dctx = nullptr;
+#endif
+
+    bool flush(size_t length, const std::function<bool(const std::vector<unsigned char>&)>& sink) {
+        if (length == 0) {
+            return true;
+        }
+        buffer.resize(length);
+        produced += length;
+        bool ok = sink(buffer);
+        buffer.resize(INFLATE_CHUNK_BYTES);
+        return ok;
+    }
+
+    bool inflateZlib(const unsigned char* data, size_t size, const std::function<bool(const std::vector<unsigned char>&)>& sink) {
+        if (!zlibReady) {
+            if (inflateInit(&strm) != Z_OK) {
+                return false;
+            }
+            zlibReady = true;
+        }
+
+        buffer.resize(INFLATE_CHUNK_BYTES);
+        strm.next_in = const_cast<unsigned char*>(data);
+        strm.avail_in = 0;
+
+        // keep going while input is left or a full buffer may leave output pending
+        bool more = true;
+        while (more) {
+            if (strm.avail_in == 0) {
+                strm.avail_in = static_cast<uInt>(std::min<size_t>(size, 1 << 30));
+                size -= strm.avail_in;
+            }
+
+            strm.next_out = buffer.data();
+            strm.avail_out = static_cast<uInt>(buffer.size());
+
+            int ret = inflate(&strm, Z_NO_FLUSH);
+            if (ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR) {
+                std::cerr << "Error:    corrupt compressed payload" << std::endl;
+                return false;
+            }
+            if (!flush(buffer.size() - strm.avail_out, sink)) {
+                return false;
+            }
+            if (ret == Z_STREAM_END) {
+                finished = true;
+                if (strm.avail_in > 0 || size > 0) {
+                    std::cerr << "Error:    trailing data after the compressed payload" << std::endl;
+                    return false;
+                }
+                break;
+            }
+
+            more = size > 0 || strm.avail_in > 0 || strm.avail_out == 0;
+        }
+
+        return true;
+    }
+
+#ifdef RSTEG_WITH_ZSTD
+    bool inflateZstd(const unsigned char* data, size_t size, const std::function<bool(const std::vector<unsigned char>&)>& sink) {
+        if (dctx == nullptr && (dctx = ZSTD_createDCtx()) == nullptr) {
+            return false;
+        }
+
+        buffer.resize(INFLATE_CHUNK_BYTES);
+        ZSTD_inBuffer input = {data, size, 0};
+
+        while (input.pos < input.size || !finished) {
+            ZSTD_outBuffer output = {buffer.data(), buffer.size(), 0};
+            size_t ret = ZSTD_decompressStream(dctx, &output, &input);
+            if (ZSTD_isError(ret)) {
+                std::cerr << "Error:    corrupt compressed payload" << std::endl;
+                return false;
+            }
+            if (!flush(output.pos, sink)) {
+                return false;
+            }
+            if (ret == 0) {
+                finished = true;
+                if (input.pos < input.size) {
+                    std::cerr << "Error:    trailing data after the compressed payload" << std::endl;
+                    return false;
+                }
+            }
+            // all input consumed and the output buffer not filled : wait for the next segment
+            if (input.pos == input.size && output.pos < output.size) {
+                break;
+            }
+        }
+
+        return true;
+    }
+#endif
+};
@@ -0,0 +1,316 @@
+#include <vector>
+#include <string>
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
+#include <zlib.h>
+#include "file_helpers.hpp"
+#include "thread_pool.hpp"
+#include "stats_helpers.hpp"
+
+extern "C" {
+    #include <png.h>
+}
+
+// row filter selection, PNG_FILTER_VALUE_* or adaptive (per row minimum sum of absolute differences)
+const int ROW_FILTER_ADAPTIVE = -1;
+
+struct PngWriteOptions {
+    int level = Z_DEFAULT_COMPRESSION;
+    int filter = ROW_FILTER_ADAPTIVE;
+    ThreadPool* pool = nullptr;     // bands the stream across the pool, nullptr : sequential libpng writer
+};
+
+inline bool parsePngFilter(const std::string& name, int& filter) {
+    if (name == "none") {
+        filter = PNG_FILTER_VALUE_NONE;
+    } else if (name == "sub") {
+        filter = PNG_FILTER_VALUE_SUB;
+    } else if (name == "up") {
+        filter = PNG_FILTER_VALUE_UP;
+    } else if (name == "avg") {
+        filter = PNG_FILTER_VALUE_AVG;
+    } else if (name == "paeth") {
+        filter = PNG_FILTER_VALUE_PAETH;
+    } else if (name == "adaptive") {
+        filter = ROW_FILTER_ADAPTIVE;
+    } else {
+        return false;
+    }
+
+    return true;
+}
+
+// libpng filter mask matching a filter selection
+inline int pngFilterMask(int filter) {
+    switch (filter) {
+        case PNG_FILTER_VALUE_NONE:  return PNG_FILTER_NONE;
+        case PNG_FILTER_VALUE_SUB:   return PNG_FILTER_SUB;
+        case PNG_FILTER_VALUE_UP:    return PNG_FILTER_UP;
+        case PNG_FILTER_VALUE_AVG:   return PNG_FILTER_AVG;
+        case PNG_FILTER_VALUE_PAETH: return PNG_FILTER_PAETH;
+        default:                     return PNG_ALL_FILTERS;
+    }
+}
+
+inline unsigned char paethPredictor(int a, int b, int c) {
+    int p = a + b - c;
+    int pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+    if (pa <= pb && pa <= pc) {
+        return static_cast<unsigned char>(a);
+    }
+    return static_cast<unsigned char>(pb <= pc ? b : c);
+}
+
+// filter one row into out[0 .. rowBytes], out[0] holds the filter type
+inline void filterRow(int type, const unsigned char* row, const unsigned char* prev, size_t rowBytes, int bpp, unsigned char* out) {
+    out[0] = static_cast<unsigned char>(type);
+    ++out;
+
+    for (size_t i = 0; i < rowBytes; ++i) {
+        int a = i >= static_cast<size_t>(bpp) ? row[i - bpp] : 0;
+        int b = prev ? prev[i] : 0;
+        int c = (prev && i >= static_cast<size_t>(bpp)) ? prev[i - bpp] : 0;
+
+        switch (type) {
+            case PNG_FILTER_VALUE_NONE:  out[i] = row[i]; break;
+            case PNG_FILTER_VALUE_SUB:   out[i] = static_cast<unsigned char>(row[i] - a); break;
+            case PNG_FILTER_VALUE_UP:    out[i] = static_cast<unsigned char>(row[i] - b); break;
+            case PNG_FILTER_VALUE_AVG:   out[i] = static_cast<unsigned char>(row[i] - ((a + b) >> 1)); break;
+            default:                     out[i] = static_cast<unsigned char>(row[i] - paethPredictor(a, b, c)); break;
+        }
+    }
+}
+
+inline void filterRows(int filter, const unsigned char* data, size_t rowBytes, int bpp, int firstRow, int lastRow, unsigned char* out) {
+    std::vector<unsigned char> candidate(filter == ROW_FILTER_ADAPTIVE ? rowBytes + 1 : 0);
+
+    for (int y = firstRow; y < lastRow; ++y) {
+        const unsigned char* row = data + rowBytes * static_cast<size_t>(y);
+        const unsigned char* prev = y > 0 ? row - rowBytes : nullptr;
+        unsigned char* dst = out + (rowBytes + 1) * static_cast<size_t>(y);
+
+        if (filter != ROW_FILTER_ADAPTIVE) {
+            filterRow(filter, row, prev, rowBytes, bpp, dst);
+            continue;
+        }
+
+        unsigned long long best = ~0ULL;
+        for (int type = PNG_FILTER_VALUE_NONE; type <= PNG_FILTER_VALUE_PAETH; ++type) {
+            filterRow(type, row, prev, rowBytes, bpp, candidate.data());
+
+            unsigned long long sum = 0;
+            for (size_t i = 1; i <= rowBytes; ++i) {
+                sum += static_cast<unsigned long long>(abs(static_cast<signed char>(candidate[i])));
+            }
+
+            if (sum < best) {
+                best = sum;
+                std::copy(candidate.begin(), candidate.end(), dst);
+            }
+        }
+    }
+}
+
+// length, type, data, crc at `offset`, 12 + length bytes
+template <typename Output>
+bool writePngChunk(Output& out, unsigned long long offset, const char* type, const unsigned char* data, size_t length) {
+    unsigned char header[8] = {
+        static_cast<unsigned char>(length >> 24), static_cast<unsigned char>(length >> 16),
+        static_cast<unsigned char>(length >> 8), static_cast<unsigned char>(length),
+        static_cast<unsigned char>(type[0]), static_cast<unsigned char>(type[1]),
+        static_cast<unsigned char>(type[2]), static_cast<unsigned char>(type[3])
+    };
+
+    uLong crc = crc32(0L, header + 4, 4);
+    if (length > 0) {
+        crc = crc32(crc, data, static_cast<uInt>(length));
+    }
+
+    unsigned char trailer[4] = {
+        static_cast<unsigned char>(crc >> 24), static_cast<unsigned char>(crc >> 16),
+        static_cast<unsigned char>(crc >> 8), static_cast<unsigned char>(crc)
+    };
+
+    return out.writeAt(header, 8, offset) &&
+           (length == 0 || out.writeAt(data, length, offset + 8)) &&
+           out.writeAt(trailer, 4, offset + 8 + length);
+}
+
+// raw deflate of one band, primed with the preceding 32K window and byte aligned
+// with a sync flush so independently compressed bands concatenate into one stream
+inline bool deflateBand(const unsigned char* data, size_t length, const unsigned char* dict, size_t dictLength, int level, bool last, std::vector<unsigned char>& out) {
+    z_stream strm{};
+    if (deflateInit2(&strm, level, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        return false;
+    }
+
+    if (dictLength > 0 && deflateSetDictionary(&strm, dict, static_cast<uInt>(dictLength)) != Z_OK) {
+        deflateEnd(&strm);
+        return false;
+    }
+
+    out.resize(deflateBound(&strm, static_cast<uLong>(length)) + 64);
+    strm.next_in = const_cast<unsigned char*>(data);
+    strm.avail_in = static_cast<uInt>(length);
+
+    size_t produced = 0;
+    int flush = last ? Z_FINISH : Z_SYNC_FLUSH;
+    int ret = Z_OK;
+
+    while (true) {
+        if (produced == out.size()) {
+            out.resize(out.size() * 2);
+        }
+        strm.next_out = out.data() + produced;
+        strm.avail_out = static_cast<uInt>(out.size() - produced);
+
+        ret = deflate(&strm, flush);
+        produced = out.size() - strm.avail_out;
+
+        if (ret == Z_STREAM_ERROR) {
+            break;
+        }
+        if (last ? ret == Z_STREAM_END : (strm.avail_in == 0 && strm.avail_out > 0)) {
+            break;
+        }
+    }
+
+    deflateEnd(&strm);
+    out.resize(produced);
+
+    return ret != Z_STREAM_ERROR;
+}
+
+// zlib stream header for `level`, 32K window
+inline void zlibHeader(int level, unsigned char* header) {
+    level = level < 0 ? 6 : level;
+    unsigned char levelHint = level < 2 ? 0 : (level < 6 ? 1 : (level == 6 ? 2 : 3));
+    header[0] = 0x78;
+    header[1] = static_cast<unsigned char>(levelHint << 6);
+    header[1] = static_cast<unsigned char>(header[1] + (31 - ((header[0] << 8) | header[1]) % 31));
+}
+
+// pigz style PNG writer : rows are filtered and deflated in independent bands
+// across the pool, then stitched into a single zlib stream (one IDAT per band).
+// The file is sized up front and every band is written at its final offset,
+// `trailer` is written after IEND.
+template <typename Output>
+bool writePngBands(Output& out, const unsigned char* data, int width, int height, int numChannels, png_byte colorType,
+                   const PngWriteOptions& options, const std::vector<unsigned char>& trailer) {
+    const size_t rowBytes = static_cast<size_t>(width) * numChannels;
+    const size_t filteredRowBytes = rowBytes + 1;
+    const size_t totalBytes = filteredRowBytes * static_cast<size_t>(height);
+    StageTimer encodeTimer(STAGE_CONTAINER_WRITE, rowBytes * static_cast<size_t>(height));
+    const size_t minBandBytes = 128 * 1024;
+    const size_t maxBandBytes = 1 << 30;
+
+    size_t numBands = std::max<size_t>(1, std::min<size_t>(options.pool->size(), totalBytes / minBandBytes));
+    numBands = std::max(numBands, (totalBytes + maxBandBytes - 1) / maxBandBytes);
+    numBands = std::min(numBands, static_cast<size_t>(height));
+
+    const int rowsPerBand = static_cast<int>((height + numBands - 1) / numBands);
+    numBands = (height + rowsPerBand - 1) / rowsPerBand;
+
+    std::vector<unsigned char> filtered(totalBytes);
+    std::vector<std::vector<unsigned char>> compressed(numBands);
+    std::vector<uLong> checksums(numBands);
+    std::vector<char> failed(numBands, 0);
+
+    auto bandRange = [&](size_t band, int& first, int& last) {
+        first = static_cast<int>(band) * rowsPerBand;
+        last = std::min(height, first + rowsPerBand);
+    };
+
+    auto runBands = [&](auto&& work) {
+        options.pool->parallelFor(numBands, 1, [&](unsigned long long first, unsigned long long last) {
+            for (unsigned long long band = first; band < last; ++band) {
+                work(static_cast<size_t>(band));
+            }
+        });
+    };
+
+    // filtering only reads the unfiltered input, every band is independent
+    runBands([&](size_t band) {
+        int first, last;
+        bandRange(band, first, last);
+        filterRows(options.filter, data, rowBytes, numChannels, first, last, filtered.data());
+    });
+
+    runBands([&](size_t band) {
+        int first, last;
+        bandRange(band, first, last);
+
+        const unsigned char* start = filtered.data() + filteredRowBytes * first;
+        size_t length = filteredRowBytes * (last - first);
+        size_t dictLength = std::min<size_t>(start - filtered.data(), 32768);
+
+        checksums[band] = adler32(adler32(0L, Z_NULL, 0), start, static_cast<uInt>(length));
+        if (!deflateBand(start, length, start - dictLength, dictLength, options.level, band + 1 == numBands, compressed[band])) {
+            failed[band] = 1;
+        }
+    });
+
+    if (std::find(failed.begin(), failed.end(), 1) != failed.end()) {
+        fprintf(stderr, "Error:     deflate failed.\n");
+        return false;
+    }
+
+    uLong adler = checksums[0];
+    for (size_t band = 1; band < numBands; ++band) {
+        int first, last;
+        bandRange(band, first, last);
+        adler = adler32_combine(adler, checksums[band], static_cast<z_off_t>(filteredRowBytes * (last - first)));
+    }
+
+    // zlib header and adler32 trailer around the raw stream
+    unsigned char header[2];
+    zlibHeader(options.level, header);
+
+    compressed[0].insert(compressed[0].begin(), header, header + 2);
+    compressed[numBands - 1].insert(compressed[numBands - 1].end(), {
+        static_cast<unsigned char>(adler >> 24), static_cast<unsigned char>(adler >> 16),
+        static_cast<unsigned char>(adler >> 8), static_cast<unsigned char>(adler)
+    });
+
+    const unsigned char signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+    unsigned char ihdr[13] = {
+        static_cast<unsigned char>(width >> 24), static_cast<unsigned char>(width >> 16),
+        static_cast<unsigned char>(width >> 8), static_cast<unsigned char>(width),
+        static_cast<unsigned char>(height >> 24), static_cast<unsigned char>(height >> 16),
+        static_cast<unsigned char>(height >> 8), static_cast<unsigned char>(height),
+        8, colorType, PNG_COMPRESSION_TYPE_BASE, PNG_FILTER_TYPE_BASE, PNG_INTERLACE_NONE
+    };
+
+    // signature, IHDR, one IDAT per band, IEND, trailer
+    std::vector<unsigned long long> bandOffsets(numBands);
+    unsigned long long offset = 8 + 12 + sizeof(ihdr);
+    for (size_t band = 0; band < numBands; ++band) {
+        bandOffsets[band] = offset;
+        offset += 12 + compressed[band].size();
+    }
+    const unsigned long long iendOffset = offset;
+    const unsigned long long trailerOffset = iendOffset + 12;
+
+    bool ok = out.resize(trailerOffset + trailer.size()) &&
+              out.writeAt(signature, 8, 0) && writePngChunk(out, 8, "IHDR", ihdr, sizeof(ihdr));
+
+    runBands([&](size_t band) {
+        if (!writePngChunk(out, bandOffsets[band], "IDAT", compressed[band].data(), compressed[band].size())) {
+            failed[band] = 1;
+        }
+    });
+
+    ok = ok && std::find(failed.begin(), failed.end(), 1) == failed.end();
+    ok = ok && writePngChunk(out, iendOffset, "IEND", nullptr, 0);
+    encodeTimer.stop();
+
+    StageTimer trailerTimer(STAGE_TRAILER_WRITE, trailer.size());
+    ok = ok && (trailer.empty() || out.writeAt(trailer.data(), trailer.size(), trailerOffset));
+
+    if (!ok) {
+        fprintf(stderr, "Error:     failed to write PNG stream.\n");
+    }
+
+    return ok;
+}
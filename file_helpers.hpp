@@ -0,0 +1,347 @@
+#include <iostream>
+#include <vector>
+#include <string>
+#include <mutex>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <filesystem>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+// Read-only view of a whole file. On POSIX the file is mmap'd and read ahead
+// sequentially, ranges already consumed can be dropped from the resident set.
+class MappedFile {
+public:
+    MappedFile() = default;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    ~MappedFile() {
+#ifndef _WIN32
+        if (mapped != nullptr) {
+            munmap(mapped, length);
+        }
+#endif
+    }
+
+    bool open(const char* filename) {
+#ifdef _WIN32
+        FILE* fp = fopen(filename, "rb");
+        if (!fp) {
+            std::cerr << "Error:    unable to open the file" << std::endl;
+            return false;
+        }
+        _fseeki64(fp, 0, SEEK_END);
+        length = static_cast<unsigned long long>(_ftelli64(fp));
+        _fseeki64(fp, 0, SEEK_SET);
+        buffer.resize(length);
+        bool ok = length == 0 || fread(buffer.data(), 1, length, fp) == length;
+        fclose(fp);
+        if (!ok) {
+            std::cerr << "Error:    unable to read the file" << std::endl;
+            return false;
+        }
+#else
+        int fd = ::open(filename, O_RDONLY);
+        if (fd < 0) {
+            std::cerr << "Error:    unable to open the file" << std::endl;
+            return false;
+        }
+
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+            ::close(fd);
+            std::cerr << "Error:    unable to open the file" << std::endl;
+            return false;
+        }
+        length = static_cast<unsigned long long>(st.st_size);
+
+        if (length > 0) {
+            void* view = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (view == MAP_FAILED) {
+                ::close(fd);
+                std::cerr << "Error:    unable to map the file" << std::endl;
+                return false;
+            }
+            mapped = static_cast<unsigned char*>(view);
+            madvise(mapped, length, MADV_SEQUENTIAL);
+        }
+        ::close(fd);
+#endif
+
+        if (length == 0) {
+            std::cerr << "Error:    no data to read" << std::endl;
+            return false;
+        }
+
+        return true;
+    }
+
+    const unsigned char* data() const {
+#ifdef _WIN32
+        return buffer.data();
+#else
+        return mapped;
+#endif
+    }
+
+    unsigned long long size() const { return length; }
+
+    // pages of [offset, offset + count) will not be read again
+    void release(unsigned long long offset, unsigned long long count) {
+#ifndef _WIN32
+        const unsigned long long page = static_cast<unsigned long long>(sysconf(_SC_PAGESIZE));
+        unsigned long long first = (offset + page - 1) / page * page;
+        unsigned long long last = std::min(length, offset + count) / page * page;
+        if (mapped != nullptr && first < last) {
+            madvise(mapped + first, last - first, MADV_DONTNEED);
+        }
+#else
+        (void)offset;
+        (void)count;
+#endif
+    }
+
+private:
+    unsigned long long length = 0;
+#ifdef _WIN32
+    std::vector<unsigned char> buffer;
+#else
+    unsigned char* mapped = nullptr;
+#endif
+};
+
+// Positional writer : the file is created (truncated) once and pieces land at
+// their final offsets in any order. On POSIX concurrent writeAt calls are safe.
+class OutputFile {
+public:
+    OutputFile() = default;
+    OutputFile(const OutputFile&) = delete;
+    OutputFile& operator=(const OutputFile&) = delete;
+
+    ~OutputFile() {
+        close();
+    }
+
+    bool open(const char* filename) {
+#ifdef _WIN32
+        fp = fopen(filename, "wb");
+        return fp != nullptr;
+#else
+        fd = ::open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        return fd >= 0;
+#endif
+    }
+
+    // pre-size the file so the filesystem can lay it out in one go
+    bool resize(unsigned long long size) {
+#ifdef _WIN32
+        (void)size;
+        return fp != nullptr;
+#else
+        return fd >= 0 && ftruncate(fd, static_cast<off_t>(size)) == 0;
+#endif
+    }
+
+    bool writeAt(const void* data, unsigned long long count, unsigned long long offset) {
+        const unsigned char* bytes = static_cast<const unsigned char*>(data);
+#ifdef _WIN32
+        std::lock_guard<std::mutex> lock(mutex);
+        return fp != nullptr && _fseeki64(fp, static_cast<long long>(offset), SEEK_SET) == 0 &&
+               fwrite(bytes, 1, count, fp) == count;
+#else
+        while (count > 0) {
+            ssize_t written = pwrite(fd, bytes, std::min<unsigned long long>(count, 1ULL << 30), static_cast<off_t>(offset));
+            if (written < 0 && errno == EINTR) {
+                continue;
+            }
+            if (written <= 0) {
+                return false;
+            }
+            bytes += written;
+            count -= written;
+            offset += written;
+        }
+        return true;
+#endif
+    }
+
+    bool close() {
+#ifdef _WIN32
+        bool ok = fp == nullptr || fclose(fp) == 0;
+        fp = nullptr;
+#else
+        bool ok = fd < 0 || ::close(fd) == 0;
+        fd = -1;
+#endif
+        return ok;
+    }
+
+private:
+#ifdef _WIN32
+    FILE* fp = nullptr;
+    std::mutex mutex;
+#else
+    int fd = -1;
+#endif
+};
+
+// OutputFile written as `path`.part and renamed to `path` by commit(), so a failed
+// or unverified run never leaves a partial file under the final name. Dropped
+// without commit, the part file is removed.
+class StagedOutputFile {
+public:
+    StagedOutputFile() = default;
+    StagedOutputFile(const StagedOutputFile&) = delete;
+    StagedOutputFile& operator=(const StagedOutputFile&) = delete;
+
+    ~StagedOutputFile() {
+        discard();
+    }
+
+    bool open(const std::string& path) {
+        target = path;
+        part = path + ".part";
+        return file.open(part.c_str());
+    }
+
+    bool resize(unsigned long long size) {
+        return file.resize(size);
+    }
+
+    bool writeAt(const void* data, unsigned long long count, unsigned long long offset) {
+        return file.writeAt(data, count, offset);
+    }
+
+    bool commit() {
+        std::error_code error;
+        bool ok = file.close();
+        if (ok) {
+            std::filesystem::rename(part, target, error);
+            ok = !error;
+        }
+        if (!ok) {
+            discard();
+            return false;
+        }
+        part.clear();
+        return true;
+    }
+
+    void discard() {
+        if (!part.empty()) {
+            file.close();
+            std::remove(part.c_str());
+            part.clear();
+        }
+    }
+
+private:
+    OutputFile file;
+    std::string target;
+    std::string part;
+};
+
+// OutputFile interface over a byte vector, for containers built in memory.
+// resize() must cover concurrent writes, the vector never grows under them.
+class OutputBuffer {
+public:
+    explicit OutputBuffer(std::vector<unsigned char>& bytes) : bytes(bytes) {}
+
+    bool resize(unsigned long long size) {
+        bytes.resize(size);
+        return true;
+    }
+
+    bool writeAt(const void* data, unsigned long long count, unsigned long long offset) {
+        if (bytes.size() < offset + count) {
+            bytes.resize(offset + count);
+        }
+        std::memcpy(bytes.data() + offset, data, count);
+        return true;
+    }
+
+private:
+    std::vector<unsigned char>& bytes;
+};
+
+// Scratch bytes on the heap, or spilled into an unlinked temporary file under
+// $TMPDIR mapped shared, so the kernel can write them back under memory pressure
+// instead of keeping them resident. Contents start zeroed either way.
+class SpillBuffer {
+public:
+    SpillBuffer() = default;
+    SpillBuffer(const SpillBuffer&) = delete;
+    SpillBuffer& operator=(const SpillBuffer&) = delete;
+
+    ~SpillBuffer() {
+        unmap();
+    }
+
+    bool allocate(unsigned long long size, bool spill) {
+        unmap();
+        heap.clear();
+        length = size;
+
+#ifndef _WIN32
+        if (spill && size > 0) {
+            const char* directory = getenv("TMPDIR");
+            std::string path = std::string(directory != nullptr && *directory != '\0' ? directory : "/tmp") + "/rsteg-spill-XXXXXX";
+            std::vector<char> name(path.begin(), path.end());
+            name.push_back('\0');
+
+            int fd = mkstemp(name.data());
+            if (fd < 0) {
+                std::cerr << "Error:    unable to create a spill file in " << path.substr(0, path.rfind('/')) << std::endl;
+                return false;
+            }
+            unlink(name.data());
+
+            void* view = MAP_FAILED;
+            if (ftruncate(fd, static_cast<off_t>(size)) == 0) {
+                view = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            }
+            ::close(fd);
+            if (view == MAP_FAILED) {
+                std::cerr << "Error:    unable to map a spill file" << std::endl;
+                return false;
+            }
+            mapped = static_cast<unsigned char*>(view);
+            return true;
+        }
+#else
+        (void)spill;
+#endif
+
+        heap.assign(size, 0);
+        return true;
+    }
+
+    unsigned char* data() {
+        return mapped != nullptr ? mapped : heap.data();
+    }
+
+    unsigned long long size() const { return length; }
+
+private:
+    std::vector<unsigned char> heap;
+    unsigned char* mapped = nullptr;
+    unsigned long long length = 0;
+
+    void unmap() {
+#ifndef _WIN32
+        if (mapped != nullptr) {
+            munmap(mapped, length);
+            mapped = nullptr;
+        }
+#endif
+    }
+};
@@ -3,13 +3,20 @@
 #include <sstream>
 #include <vector>
 #include <cstdint>
+#include <cstring>
+#include <climits>
+#include <functional>
+#include <thread>
 #include <opencv2/opencv.hpp>
+#include "deflate_helpers.hpp"
+#include "stats_helpers.hpp"
+#include "thread_pool.hpp"
 
 extern "C" {
     #include <png.h>
 }
 
-bool readAes256KeyFromFile(const char* fileName, unsigned char* key, int keySize) {
+inline bool readAes256KeyFromFile(const char* fileName, unsigned char* key, int keySize) {
     std::ifstream file(fileName);
     if (!file.is_open()) {
         std::cerr << "Error:    unable to read key file" << fileName << std::endl;
@@ -38,7 +45,7 @@ bool readAes256KeyFromFile(const char* fileName, unsigned char* key, int keySize
 }
 
 // update for linux IO
-bool readBinaryFile(const char* filename, std::vector<unsigned char>& data) {
+inline bool readBinaryFile(const char* filename, std::vector<unsigned char>& data) {
     std::ifstream inputFile(filename, std::ios::binary);
     if (!inputFile.is_open()) {
         std::cerr << "Error:    unable to open the file" << std::endl;
@@ -62,181 +69,413 @@ bool readBinaryFile(const char* filename, std::vector<unsigned char>& data) {
     return true;
 }
 
-std::pair<std::vector<int>, std::vector<unsigned char>> readImage(const char* filename) {
-    FILE* fp = fopen(filename, "rb");
-    if (!fp) {
-        fprintf(stderr, "Error:     unable to read PNG file\n");
-        exit(1);
+// in memory PNG source for png_set_read_fn
+struct PngBuffer {
+    const unsigned char* data;
+    size_t size;
+    size_t offset;
+};
+
+inline void readPngBuffer(png_structp png, png_bytep out, png_size_t length) {
+    PngBuffer* buffer = static_cast<PngBuffer*>(png_get_io_ptr(png));
+    if (buffer->size - buffer->offset < length) {
+        png_error(png, "read past the end of the PNG buffer");
     }
+    memcpy(out, buffer->data + buffer->offset, length);
+    buffer->offset += length;
+}
 
+// Decode a PNG from `fp`, or from `buffer` when fp is NULL. { width, height, channels }
+// land in `imageInfo`, `pixels( bytes )` hands out the destination once the geometry
+// is known and returns NULL if it cannot.
+inline bool readPngPixels(FILE* fp, PngBuffer* buffer, std::vector<int>& imageInfo, const std::function<unsigned char*(size_t)>& pixels) {
     png_structp png = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
     if (!png) {
-        fclose(fp);
         fprintf(stderr, "png_create_read_struct failed.\n");
-        exit(1);
+        return false;
     }
 
     png_infop info = png_create_info_struct(png);
     if (!info) {
-        fclose(fp);
         png_destroy_read_struct(&png, NULL, NULL);
         fprintf(stderr, "png_create_info_struct failed.\n");
-        exit(1);
+        return false;
     }
 
+    std::vector<png_bytep> rows;
+
     if (setjmp(png_jmpbuf(png))) {
-        fclose(fp);
         png_destroy_read_struct(&png, &info, NULL);
         fprintf(stderr, "Error during png_init_io or png_read_info.\n");
-        exit(1);
+        return false;
     }
 
-    png_init_io(png, fp);
+    if (fp) {
+        png_init_io(png, fp);
+    } else {
+        png_set_read_fn(png, buffer, readPngBuffer);
+    }
     png_read_info(png, info);
 
-    int width = png_get_image_width(png, info);
-    int height = png_get_image_height(png, info);
     png_byte color_type = png_get_color_type(png, info);
     png_byte bit_depth = png_get_bit_depth(png, info);
 
-    int num_channels = (color_type == PNG_COLOR_TYPE_RGB) ? 3 : 4;
+    // normalize to 8-bit samples : palette -> RGB, low bit gray -> 8 bit,
+    // tRNS -> alpha, 16 bit -> 8 bit. gray / gray+alpha keep their channels.
+    if (color_type == PNG_COLOR_TYPE_PALETTE) {
+        png_set_palette_to_rgb(png);
+    }
+    if (color_type == PNG_COLOR_TYPE_GRAY && bit_depth < 8) {
+        png_set_expand_gray_1_2_4_to_8(png);
+    }
+    if (png_get_valid(png, info, PNG_INFO_tRNS)) {
+        png_set_tRNS_to_alpha(png);
+    }
+    if (bit_depth == 16) {
+        png_set_strip_16(png);
+    }
+    png_set_interlace_handling(png);
+    png_read_update_info(png, info);
 
-    std::vector<unsigned char> imageData;
-    png_bytep row = (png_bytep)malloc(num_channels * width);
+    int width = png_get_image_width(png, info);
+    int height = png_get_image_height(png, info);
+    int num_channels = png_get_channels(png, info);
+    size_t rowBytes = png_get_rowbytes(png, info);
 
+    // decode straight into the final buffer
+    unsigned char* imageData = pixels(rowBytes * static_cast<size_t>(height));
+    if (imageData == NULL) {
+        png_destroy_read_struct(&png, &info, NULL);
+        return false;
+    }
+    rows.resize(height);
     for (int y = 0; y < height; y++) {
-        png_read_row(png, row, NULL);
-        for (int x = 0; x < width; x++) {
-            for (int c = 0; c < num_channels; c++) {
-                imageData.push_back(row[x * num_channels + c]);
-            }
-        }
+        rows[y] = imageData + rowBytes * static_cast<size_t>(y);
     }
 
-    free(row);
-    fclose(fp);
+    png_read_image(png, rows.data());
+
     png_destroy_read_struct(&png, &info, NULL);
 
-    return std::make_pair(std::vector<int>{width, height, num_channels}, imageData);
+    imageInfo = {width, height, num_channels};
+
+    return true;
 }
 
-bool writeImage(const char* filename, const std::vector<unsigned char>& imageData, int width, int height, int numChannels) {
-    FILE* fp = fopen(filename, "wb");
+// into { { width, height, channels }, pixels }
+inline bool readPng(FILE* fp, PngBuffer* buffer, std::pair<std::vector<int>, std::vector<unsigned char>>& image) {
+    // decode into the caller's pixel buffer, its capacity is reused across calls
+    return readPngPixels(fp, buffer, image.first, [&](size_t bytes) {
+        image.second.resize(bytes);
+        return image.second.data();
+    });
+}
+
+inline bool readImage(const char* filename, std::pair<std::vector<int>, std::vector<unsigned char>>& image) {
+    StageTimer timer(STAGE_CONTAINER_READ);
+    FILE* fp = fopen(filename, "rb");
     if (!fp) {
-        fprintf(stderr, "Error:     failed to create output PNG\n");
+        fprintf(stderr, "Error:     unable to read PNG file\n");
+        return false;
+    }
+
+    bool read = readPng(fp, NULL, image);
+    fclose(fp);
+    timer.count(image.second.size());
+
+    return read;
+}
+
+// pixels into `spillBuffer`, on the heap or in a spill file as `spill` asks
+inline bool readImage(const char* filename, std::vector<int>& imageInfo, SpillBuffer& spillBuffer, bool spill) {
+    StageTimer timer(STAGE_CONTAINER_READ);
+    FILE* fp = fopen(filename, "rb");
+    if (!fp) {
+        fprintf(stderr, "Error:     unable to read PNG file\n");
+        return false;
+    }
+
+    bool read = readPngPixels(fp, NULL, imageInfo, [&](size_t bytes) {
+        return spillBuffer.allocate(bytes, spill) ? spillBuffer.data() : NULL;
+    });
+    fclose(fp);
+    timer.count(spillBuffer.size());
+
+    return read;
+}
+
+// { width, height, channels } from the chunks ahead of IDAT, channels as readPng
+// normalizes them. Nothing is inflated, so this costs a few small reads.
+inline bool readPngInfo(const char* filename, std::vector<int>& imageInfo) {
+    FILE* fp = fopen(filename, "rb");
+    if (!fp) {
+        fprintf(stderr, "Error:     unable to read PNG file\n");
+        return false;
+    }
+
+    unsigned char header[8];
+    bool valid = fread(header, 1, 8, fp) == 8 && png_sig_cmp(header, 0, 8) == 0;
+    int width = 0, height = 0, colorType = -1;
+    bool transparency = false;
+
+    while (valid) {
+        unsigned char chunk[8];
+        if (fread(chunk, 1, 8, fp) != 8) {
+            valid = false;
+            break;
+        }
+
+        unsigned long length = (static_cast<unsigned long>(chunk[0]) << 24) | (chunk[1] << 16) | (chunk[2] << 8) | chunk[3];
+        if (memcmp(chunk + 4, "IDAT", 4) == 0 || memcmp(chunk + 4, "IEND", 4) == 0) {
+            break;
+        }
+
+        if (memcmp(chunk + 4, "IHDR", 4) == 0) {
+            unsigned char ihdr[13];
+            if (length != 13 || fread(ihdr, 1, 13, fp) != 13) {
+                valid = false;
+                break;
+            }
+            width = static_cast<int>(std::min<png_uint_32>(png_get_uint_32(ihdr), INT_MAX));
+            height = static_cast<int>(std::min<png_uint_32>(png_get_uint_32(ihdr + 4), INT_MAX));
+            colorType = ihdr[9];
+            length = 0;
+        } else if (memcmp(chunk + 4, "tRNS", 4) == 0) {
+            transparency = true;
+        }
+
+        // skip the chunk data and its CRC
+        valid = valid && fseek(fp, static_cast<long>(length) + 4, SEEK_CUR) == 0;
+    }
+    fclose(fp);
+
+    int channels = 0;
+    switch (colorType) {
+        case PNG_COLOR_TYPE_GRAY:       channels = transparency ? 2 : 1; break;
+        case PNG_COLOR_TYPE_GRAY_ALPHA: channels = 2; break;
+        case PNG_COLOR_TYPE_RGB:
+        case PNG_COLOR_TYPE_PALETTE:    channels = transparency ? 4 : 3; break;
+        case PNG_COLOR_TYPE_RGB_ALPHA:  channels = 4; break;
+    }
+
+    if (!valid || width <= 0 || height <= 0 || channels == 0) {
+        fprintf(stderr, "Error:     invalid PNG header\n");
         return false;
     }
 
+    imageInfo = std::vector<int>{width, height, channels};
+
+    return true;
+}
+
+// PNG held in memory, bytes past IEND ( a seed trailer ) are ignored
+inline bool decodeImage(const unsigned char* data, size_t size, std::pair<std::vector<int>, std::vector<unsigned char>>& image) {
+    PngBuffer buffer = {data, size, 0};
+
+    return readPng(NULL, &buffer, image);
+}
+
+// sequential libpng output on top of a positional writer
+template <typename Output>
+struct PngSink {
+    Output* out;
+    unsigned long long offset;
+};
+
+template <typename Output>
+void writePngSink(png_structp png, png_bytep data, png_size_t length) {
+    PngSink<Output>* sink = static_cast<PngSink<Output>*>(png_get_io_ptr(png));
+    if (!sink->out->writeAt(data, length, sink->offset)) {
+        png_error(png, "write failed");
+    }
+    sink->offset += length;
+}
+
+inline void flushPngSink(png_structp) {}
+
+// `trailer` is written right after the PNG stream, in the same pass
+template <typename Output>
+bool encodePng(Output& out, const unsigned char* imageData, int width, int height, int numChannels,
+               const PngWriteOptions& options, const std::vector<unsigned char>& trailer) {
+    png_byte color_type;
+    if (numChannels == 1) {
+        color_type = PNG_COLOR_TYPE_GRAY;
+    } else if (numChannels == 2) {
+        color_type = PNG_COLOR_TYPE_GRAY_ALPHA;
+    } else if (numChannels == 3) {
+        color_type = PNG_COLOR_TYPE_RGB;
+    } else if (numChannels == 4) {
+        color_type = PNG_COLOR_TYPE_RGBA;
+    } else {
+        fprintf(stderr, "Error:     unsupported number of channels.\n");
+        return false;
+    }
+
+    if (options.pool != nullptr && options.pool->size() > 1) {
+        return writePngBands(out, imageData, width, height, numChannels, color_type, options, trailer);
+    }
+
     png_structp png = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
     if (!png) {
-        fclose(fp);
         fprintf(stderr, "png_create_write_struct failed.\n");
-        fclose(fp);
         return false;
     }
 
     png_infop info = png_create_info_struct(png);
     if (!info) {
-        fclose(fp);
         png_destroy_write_struct(&png, (png_infopp)NULL);
         fprintf(stderr, "png_create_info_struct failed.\n");
         return false;
     }
 
+    StageTimer encodeTimer(STAGE_CONTAINER_WRITE, static_cast<unsigned long long>(width) * height * numChannels);
+    PngSink<Output> sink = {&out, 0};
+    std::vector<png_bytep> rows(height);
+
     if (setjmp(png_jmpbuf(png))) {
-        fclose(fp);
         png_destroy_write_struct(&png, &info);
         fprintf(stderr, "Error during png_init_io or png_write_info.\n");
         return false;
     }
 
-    png_init_io(png, fp);
+    png_set_write_fn(png, &sink, writePngSink<Output>, flushPngSink);
+    png_set_compression_buffer_size(png, 1 << 16);
 
-    png_byte color_type;
-    if (numChannels == 3) {
-        color_type = PNG_COLOR_TYPE_RGB;
-    } else if (numChannels == 4) {
-        color_type = PNG_COLOR_TYPE_RGBA;
-    } else {
-        fclose(fp);
-        png_destroy_write_struct(&png, &info);
-        fprintf(stderr, "Error:     unsupported number of channels.\n");
-        return false;
-    }
+    png_set_compression_level(png, options.level);
+    png_set_compression_strategy(png, Z_DEFAULT_STRATEGY);
+    png_set_filter(png, 0, pngFilterMask(options.filter));
 
     png_set_IHDR(png, info, width, height, 8, color_type, PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
     png_write_info(png, info);
 
-    png_set_compression_level(png, 0);
-    png_set_compression_strategy(png, 0);
-    png_set_filter(png, 0, PNG_FILTER_NONE);
-
-    std::vector<png_byte> row(numChannels * width);
-
+    // rows point straight into the pixel buffer
+    const size_t rowBytes = static_cast<size_t>(numChannels) * width;
     for (int y = 0; y < height; y++) {
-        for (int x = 0; x < numChannels * width; x++) {
-            row[x] = imageData[y * numChannels * width + x];
-        }
-        png_write_row(png, row.data());
+        rows[y] = const_cast<png_bytep>(imageData + rowBytes * static_cast<size_t>(y));
     }
 
+    png_write_image(png, rows.data());
     png_write_end(png, NULL);
 
-    fclose(fp);
     png_destroy_write_struct(&png, &info);
+    encodeTimer.stop();
 
-    return true;
+    StageTimer trailerTimer(STAGE_TRAILER_WRITE, trailer.size());
+    return trailer.empty() || out.writeAt(trailer.data(), trailer.size(), sink.offset);
+}
+
+inline bool writeImage(const char* filename, const unsigned char* imageData, int width, int height, int numChannels,
+                const PngWriteOptions& options = PngWriteOptions(), const std::vector<unsigned char>& trailer = std::vector<unsigned char>()) {
+    OutputFile out;
+    if (!out.open(filename)) {
+        fprintf(stderr, "Error:     failed to create output PNG\n");
+        return false;
+    }
+
+    bool written = encodePng(out, imageData, width, height, numChannels, options, trailer);
+
+    return out.close() && written;
+}
+
+inline bool writeImage(const char* filename, const std::vector<unsigned char>& imageData, int width, int height, int numChannels,
+                const PngWriteOptions& options = PngWriteOptions(), const std::vector<unsigned char>& trailer = std::vector<unsigned char>()) {
+    return writeImage(filename, imageData.data(), width, height, numChannels, options, trailer);
+}
+
+// PNG ( and trailer ) into `png`
+inline bool encodeImage(const std::vector<unsigned char>& imageData, int width, int height, int numChannels,
+                 const PngWriteOptions& options, const std::vector<unsigned char>& trailer, std::vector<unsigned char>& png) {
+    png.clear();
+    OutputBuffer out(png);
+
+    return encodePng(out, imageData.data(), width, height, numChannels, options, trailer);
 }
 
 // extract seed
-std::vector<unsigned char> decodeSeedBytes(const std::string& filePath) {
-    std::vector<unsigned char> decodedSeedBytes;
-    
+inline bool decodeSeedBytes(const std::string& filePath, std::vector<unsigned char>& decodedSeedBytes) {
+    StageTimer timer(STAGE_TRAILER_READ);
     std::ifstream inputFile(filePath, std::ios::binary);
     
     if (!inputFile.is_open()) {
         std::cerr << "Error: unable to read seed" << std::endl;
-        exit(1);
+        return false;
     }
     
+    inputFile.seekg(0, std::ios::end);
+    std::streamoff fileSize = inputFile.tellg();
+
     inputFile.seekg(-1, std::ios::end);
     int seedLength = 0;
     inputFile.read(reinterpret_cast<char*>(&seedLength), 1);
 
-    if (seedLength < 0) {
+    if (!inputFile || seedLength <= 0 || seedLength + 1 > fileSize) {
         std::cerr << "Error: invalid seed length" << std::endl;
-        exit(1);
+        return false;
     }
     
     decodedSeedBytes.resize(seedLength);
+    timer.count(seedLength + 1);
 
     inputFile.seekg(-seedLength-1, std::ios::cur);
     inputFile.read(reinterpret_cast<char*>(&decodedSeedBytes[0]), seedLength);
     
     inputFile.close();
     
-    return decodedSeedBytes;
+    return true;
+}
+
+// the `length` bytes in front of a `seedLength` byte seed at the end of a file
+inline bool readTrailerPrefix(const std::string& filePath, size_t seedLength, unsigned char* prefix, size_t length) {
+    StageTimer timer(STAGE_TRAILER_READ, length);
+    std::ifstream inputFile(filePath, std::ios::binary);
+
+    inputFile.seekg(0, std::ios::end);
+    std::streamoff fileSize = inputFile.tellg();
+    std::streamoff offset = fileSize - static_cast<std::streamoff>(seedLength + 1 + length);
+
+    if (!inputFile || offset < 0 || !inputFile.seekg(offset) || !inputFile.read(reinterpret_cast<char*>(prefix), length)) {
+        std::cerr << "Error:    missing payload MAC" << std::endl;
+        return false;
+    }
+
+    return true;
 }
 
-std::pair<std::vector<int>, std::vector<unsigned char>> readVideo(const char* videoFileName) {
+// seed trailer at the end of an in memory container
+inline bool splitSeedBytes(const unsigned char* data, size_t size, std::vector<unsigned char>& decodedSeedBytes) {
+    size_t seedLength = size > 0 ? data[size - 1] : 0;
+
+    if (seedLength == 0 || seedLength + 1 > size) {
+        std::cerr << "Error: invalid seed length" << std::endl;
+        return false;
+    }
+
+    decodedSeedBytes.assign(data + size - 1 - seedLength, data + size - 1);
+
+    return true;
+}
+
+// Decodes frames until `maxBytes` of the concatenated stream are available, so
+// a payload confined to the leading positions never touches the trailing frames.
+inline bool readVideo(const char* videoFileName, std::pair<std::vector<int>, std::vector<unsigned char>>& video, unsigned long long maxBytes = ULLONG_MAX) {
+    StageTimer timer(STAGE_CONTAINER_READ);
     cv::VideoCapture cap(videoFileName);
 
     if (!cap.isOpened()) {
         std::cerr << "Error: Could not open the video file." << std::endl;
-        exit(1);
+        return false;
     }
 
-    std::cout << "Reading video file..." << std::endl;
-
     int width = static_cast<int>(cap.get(cv::CAP_PROP_FRAME_WIDTH));
     int height = static_cast<int>(cap.get(cv::CAP_PROP_FRAME_HEIGHT));
+    unsigned long long numFrames = static_cast<unsigned long long>(std::max(0.0, cap.get(cv::CAP_PROP_FRAME_COUNT)));
     int numChannels = 0;
 
     cv::Mat frame;
 
     std::vector<unsigned char> bytes;
 
-    while (true) {
+    while (bytes.size() < maxBytes) {
         cap >> frame; // Read a frame
 
         if (frame.empty()) {
@@ -245,22 +484,242 @@ std::pair<std::vector<int>, std::vector<unsigned char>> readVideo(const char* vi
 
         numChannels = frame.channels(); // Get the number of color channels
 
-        // Iterate through each pixel in the frame
-        for (int y = 0; y < frame.rows; ++y) {
-            for (int x = 0; x < frame.cols; ++x) {
-                for (int c = 0; c < numChannels; ++c) {
-                    bytes.push_back(frame.at<uchar>(y, x * numChannels + c));
-                }
+        size_t rowBytes = static_cast<size_t>(frame.cols) * numChannels;
+
+        if (bytes.empty()) {
+            unsigned long long frameBytes = rowBytes * frame.rows;
+            unsigned long long framesNeeded = maxBytes == ULLONG_MAX ? numFrames : (maxBytes + frameBytes - 1) / frameBytes;
+            if (numFrames > 0) {
+                bytes.reserve(std::min(framesNeeded, numFrames) * frameBytes);
             }
         }
+
+        // append the frame row by row
+        for (int y = 0; y < frame.rows; ++y) {
+            const unsigned char* row = frame.ptr(y);
+            bytes.insert(bytes.end(), row, row + rowBytes);
+        }
+    }
+
+    cap.release();
+    timer.count(bytes.size());
+
+    video = std::make_pair(std::vector<int>{width, height, numChannels}, std::move(bytes));
+
+    return true;
+}
+
+// { width, height, channels, frames } without decoding the whole stream. With
+// `headerOnly` no frame is decoded and channels is the 3 of OpenCV's BGR output.
+inline bool readVideoInfo(const char* videoFileName, std::vector<int>& videoInfo, bool headerOnly = false) {
+    cv::VideoCapture cap(videoFileName);
+
+    if (!cap.isOpened()) {
+        std::cerr << "Error: Could not open the video file." << std::endl;
+        return false;
+    }
+
+    int width = static_cast<int>(cap.get(cv::CAP_PROP_FRAME_WIDTH));
+    int height = static_cast<int>(cap.get(cv::CAP_PROP_FRAME_HEIGHT));
+    int numFrames = static_cast<int>(cap.get(cv::CAP_PROP_FRAME_COUNT));
+
+    int numChannels = 3;
+    if (!headerOnly) {
+        cv::Mat frame;
+        cap >> frame;
+        numChannels = frame.empty() ? 0 : frame.channels();
     }
 
     cap.release();
 
-    return std::make_pair(std::vector<int>{width, height, numChannels}, bytes);
+    videoInfo = std::vector<int>{width, height, numChannels, numFrames};
+
+    return true;
+}
+
+// Frames in flight between the decode, embed and encode stages. Each stage runs on
+// its own thread, so a run takes about as long as the slowest of them.
+const int VIDEO_PIPELINE_FRAMES = 4;
+
+struct VideoFrame {
+    cv::Mat mat;
+    unsigned long long offset = 0;
+    unsigned long long bytes = 0;
+};
+
+// Reader stage : decodes into buffers taken from `freeFrames` until the stream
+// ends or `maxBytes` are covered, then queues a null frame.
+inline void decodeFrames(cv::VideoCapture& cap, unsigned long long maxBytes,
+                  BlockingQueue<VideoFrame*>& freeFrames, BlockingQueue<VideoFrame*>& decoded) {
+    unsigned long long offset = 0;
+
+    while (offset < maxBytes) {
+        VideoFrame* frame = freeFrames.pop();
+
+        StageTimer readTimer(STAGE_CONTAINER_READ);
+        if (!cap.read(frame->mat) || frame->mat.empty()) {
+            break;
+        }
+        if (!frame->mat.isContinuous()) {
+            frame->mat = frame->mat.clone();
+        }
+
+        frame->offset = offset;
+        frame->bytes = static_cast<unsigned long long>(frame->mat.total()) * frame->mat.elemSize();
+        offset += frame->bytes;
+        readTimer.count(frame->bytes);
+        readTimer.stop();
+
+        decoded.push(frame);
+    }
+
+    decoded.push(nullptr);
+}
+
+// Decode, transform and re-encode a video frame by frame : a reader thread, `embed`
+// on the calling thread and a writer thread pass `pipelineFrames` recycled
+// buffers around, so peak memory stays a few frames ( one runs the stages in turn ). `embed` gets each frame's
+// bytes in order with their offset in the stream readVideo would return. Fails if
+// the stream ends before `requiredBytes`. OpenCV owns the container file, the
+// bytes `trailer` fills in once every frame is embedded are appended after it is closed.
+inline bool streamVideo(const char* inputFileName, const char* outputFileName, unsigned long long requiredBytes,
+                 const std::function<void(unsigned char*, unsigned long long, unsigned long long)>& embed,
+                 const std::function<bool(std::vector<unsigned char>&)>& trailer = nullptr,
+                 int pipelineFrames = VIDEO_PIPELINE_FRAMES) {
+    cv::VideoCapture cap(inputFileName);
+
+    if (!cap.isOpened()) {
+        std::cerr << "Error: Could not open the video file." << std::endl;
+        return false;
+    }
+
+    int width = static_cast<int>(cap.get(cv::CAP_PROP_FRAME_WIDTH));
+    int height = static_cast<int>(cap.get(cv::CAP_PROP_FRAME_HEIGHT));
+
+    cv::VideoWriter writer(outputFileName, cv::VideoWriter::fourcc('F','F','V','1'), 30, cv::Size(width, height), true);
+
+    if (!writer.isOpened()) {
+        std::cerr << "Error: Could not open the VideoWriter." << std::endl;
+        return false;
+    }
+
+    std::vector<VideoFrame> frames(std::max(1, pipelineFrames));
+    BlockingQueue<VideoFrame*> freeFrames, decoded, embedded;
+    for (VideoFrame& frame : frames) {
+        freeFrames.push(&frame);
+    }
+
+    StageStats* stats = activeStageStats;
+    StageStats readerStats, writerStats;
+
+    std::thread reader([&] {
+        StageScope scope(stats != nullptr ? &readerStats : nullptr);
+        decodeFrames(cap, ULLONG_MAX, freeFrames, decoded);
+        cap.release();
+    });
+
+    std::thread encoder([&] {
+        StageScope scope(stats != nullptr ? &writerStats : nullptr);
+        while (VideoFrame* frame = embedded.pop()) {
+            StageTimer writeTimer(STAGE_CONTAINER_WRITE, frame->bytes);
+            writer.write(frame->mat);
+            writeTimer.stop();
+            freeFrames.push(frame);
+        }
+        StageTimer writeTimer(STAGE_CONTAINER_WRITE);
+        writer.release();
+    });
+
+    // the embed callback keeps payload state, frames reach it in stream order
+    unsigned long long offset = 0;
+    while (VideoFrame* frame = decoded.pop()) {
+        if (frame->offset < requiredBytes) {
+            embed(frame->mat.data, frame->bytes, frame->offset);
+        }
+        offset = frame->offset + frame->bytes;
+        embedded.push(frame);
+    }
+    embedded.push(nullptr);
+
+    reader.join();
+    encoder.join();
+    if (stats != nullptr) {
+        addStageStats(*stats, readerStats);
+        addStageStats(*stats, writerStats);
+    }
+
+    if (offset < requiredBytes) {
+        std::cerr << "Error: video ended before all embed positions were written." << std::endl;
+        return false;
+    }
+
+    std::vector<unsigned char> trailerBytes;
+    if (trailer && !trailer(trailerBytes)) {
+        return false;
+    }
+
+    if (!trailerBytes.empty()) {
+        StageTimer trailerTimer(STAGE_TRAILER_WRITE, trailerBytes.size());
+        FILE* fp = fopen(outputFileName, "ab");
+        bool written = fp && fwrite(trailerBytes.data(), 1, trailerBytes.size(), fp) == trailerBytes.size();
+        if (!fp || fclose(fp) != 0 || !written) {
+            std::cerr << "Error: failed to append the seed trailer." << std::endl;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Read-only counterpart of streamVideo : a reader thread decodes ahead while
+// `extract` gets the frames in order on the calling thread, until
+// `requiredBytes` are covered.
+inline bool scanVideo(const char* inputFileName, unsigned long long requiredBytes,
+               const std::function<void(const unsigned char*, unsigned long long, unsigned long long)>& extract,
+               int pipelineFrames = VIDEO_PIPELINE_FRAMES) {
+    cv::VideoCapture cap(inputFileName);
+
+    if (!cap.isOpened()) {
+        std::cerr << "Error: Could not open the video file." << std::endl;
+        return false;
+    }
+
+    std::vector<VideoFrame> frames(std::max(1, pipelineFrames));
+    BlockingQueue<VideoFrame*> freeFrames, decoded;
+    for (VideoFrame& frame : frames) {
+        freeFrames.push(&frame);
+    }
+
+    StageStats* stats = activeStageStats;
+    StageStats readerStats;
+
+    std::thread reader([&] {
+        StageScope scope(stats != nullptr ? &readerStats : nullptr);
+        decodeFrames(cap, requiredBytes, freeFrames, decoded);
+        cap.release();
+    });
+
+    unsigned long long offset = 0;
+    while (VideoFrame* frame = decoded.pop()) {
+        extract(frame->mat.data, frame->bytes, frame->offset);
+        offset = frame->offset + frame->bytes;
+        freeFrames.push(frame);
+    }
+
+    reader.join();
+    if (stats != nullptr) {
+        addStageStats(*stats, readerStats);
+    }
+
+    if (offset < requiredBytes) {
+        std::cerr << "Error: video ended before all embed positions were read." << std::endl;
+        return false;
+    }
+
+    return true;
 }
 
-bool writeVideo(const char* videoFileName, const std::vector<unsigned char>& bytes, int width, int height, int numChannels) {
+inline bool writeVideo(const char* videoFileName, const std::vector<unsigned char>& bytes, int width, int height, int numChannels) {
     cv::VideoWriter writer(videoFileName, cv::VideoWriter::fourcc('F','F','V','1'), 30, cv::Size(width, height), true);
 
     if (!writer.isOpened()) {
@@ -0,0 +1,959 @@
+#include <iomanip>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include "librsteg.hpp"
+#include "io_helpers.hpp"
+#include "lsb_rand.hpp"
+#include "aes_helpers.hpp"
+#include "pipeline_helpers.hpp"
+#include "compress_helpers.hpp"
+#include "position_cache.hpp"
+#include "memory_plan.hpp"
+
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+// decoded container pixels, kept per batch runner so buffers are reused across jobs
+typedef std::pair<std::vector<int>, std::vector<unsigned char>> Image;
+
+struct Rsteg::Impl {
+    RstegOptions options;
+    PngWriteOptions pngOptions;
+    ThreadPool pool;
+
+    explicit Impl(const RstegOptions& options) : options(options), pool(std::max(1u, options.threads)) {
+        pngOptions.level = options.pngLevel;
+        pngOptions.pool = &pool;
+        if (!parsePngFilter(options.pngFilter, pngOptions.filter)) {
+            pngOptions.filter = ROW_FILTER_ADAPTIVE;
+        }
+    }
+
+    // progress lines go to stdout only in verbose mode
+    std::ostream& progress() const {
+        thread_local std::ostream quiet(nullptr);
+        return options.verbose ? std::cout : quiet;
+    }
+
+    PositionCache positionCache(const unsigned char* seedKey) const {
+        PositionCache cache;
+        cache.directory = options.positionCache;
+        cache.maxBytes = options.positionCacheBytes;
+        cache.key = seedKey;
+        return cache;
+    }
+
+    // `memoryBudget` : peak bytes for this job, 0 : unlimited
+    RstegStatus embedFile(Image& image, const char* containerPath, const char* payloadPath, const char* outputPath,
+                          const unsigned char* messageKey, const unsigned char* seedKey, unsigned long long memoryBudget);
+
+    RstegStatus extractFile(Image& stegoImage, const char* containerPath, const std::string& outputBase,
+                            const unsigned char* messageKey, const unsigned char* seedKey, std::string& outputPath,
+                            unsigned long long memoryBudget);
+};
+
+const char* rstegStatusMessage(RstegStatus status) {
+    switch (status) {
+        case RSTEG_OK:            return "ok";
+        case RSTEG_ERR_ARGUMENT:  return "invalid argument";
+        case RSTEG_ERR_IO:        return "unable to read or write file";
+        case RSTEG_ERR_CONTAINER: return "unable to process container";
+        case RSTEG_ERR_CAPACITY:  return "insufficient container size";
+        case RSTEG_ERR_SEED:      return "unable to recover seed";
+        case RSTEG_ERR_CRYPTO:    return "unable to encrypt or decrypt embedded file";
+        case RSTEG_ERR_MEMORY:    return "job does not fit the memory budget";
+    }
+    return "unknown error";
+}
+
+const char* rstegStageName(RstegStage stage) {
+    static const char* names[RSTEG_STAGE_COUNT] = {
+        "container_read", "key_load", "seed", "positions", "encrypt", "embed",
+        "container_write", "trailer_write", "trailer_read", "extract", "decrypt", "output_write",
+        "compress", "decompress"
+    };
+    return stage < RSTEG_STAGE_COUNT ? names[stage] : "unknown";
+}
+
+static_assert(static_cast<int>(RSTEG_STAGE_COUNT) == static_cast<int>(STAGE_COUNT), "stage lists out of sync");
+
+// runs fn with the calling thread's stage timers feeding `stats`
+template <typename Fn>
+static RstegStatus withStats(RstegStats* stats, Fn fn) {
+    if (stats == nullptr) {
+        return fn();
+    }
+
+    StageStats stageStats;
+    RstegStatus status;
+    {
+        StageScope scope(&stageStats);
+        status = fn();
+    }
+
+    for (int stage = 0; stage < STAGE_COUNT; ++stage) {
+        stats->ns[stage] += stageStats.ns[stage];
+        stats->bytes[stage] += stageStats.bytes[stage];
+    }
+
+    return status;
+}
+
+unsigned long long rstegPeakMemory() {
+#ifdef _WIN32
+    return 0;
+#else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+        return 0;
+    }
+#ifdef __APPLE__
+    return static_cast<unsigned long long>(usage.ru_maxrss);
+#else
+    return static_cast<unsigned long long>(usage.ru_maxrss) * 1024;
+#endif
+#endif
+}
+
+RstegStatus rstegReadKeyFile(const char* path, unsigned char* key) {
+    return readAes256KeyFromFile(path, key, RSTEG_KEY_SIZE) ? RSTEG_OK : RSTEG_ERR_ARGUMENT;
+}
+
+bool rstegSetSimdLevel(const std::string& level) {
+    return setSimdLevel(level);
+}
+
+RstegStatus rstegCheckOptions(const RstegOptions& options) {
+    int filter = ROW_FILTER_ADAPTIVE;
+    if (options.pngLevel < -1 || options.pngLevel > 9) {
+        std::cerr << "Error:    PNG level expects a value in [ 0 - 9 ]" << std::endl;
+        return RSTEG_ERR_ARGUMENT;
+    }
+    if (!parsePngFilter(options.pngFilter, filter)) {
+        std::cerr << "Error:    unknown PNG filter " << options.pngFilter << std::endl;
+        return RSTEG_ERR_ARGUMENT;
+    }
+    if (options.bits < LSB_MIN_BITS || options.bits > LSB_MAX_BITS) {
+        std::cerr << "Error:    LSB depth expects a value in [ 1 - 4 ]" << std::endl;
+        return RSTEG_ERR_ARGUMENT;
+    }
+    unsigned char positionMode = POSITIONS_SEGMENTED_PERMUTATION;
+    if (!parsePositionMode(options.positions, positionMode)) {
+        std::cerr << "Error:    unknown position order " << options.positions << std::endl;
+        return RSTEG_ERR_ARGUMENT;
+    }
+    unsigned char compression = PAYLOAD_COMPRESSION_NONE;
+    if (!parseCompression(options.compression, compression)) {
+        std::cerr << "Error:    unknown compression " << options.compression << std::endl;
+        return RSTEG_ERR_ARGUMENT;
+    }
+    if (!compressionAvailable(compression)) {
+        std::cerr << "Error:    this build has no " << options.compression << " support" << std::endl;
+        return RSTEG_ERR_ARGUMENT;
+    }
+    if (!compressionLevelValid(compression, options.compressionLevel)) {
+        std::cerr << "Error:    compression level out of range for " << options.compression << std::endl;
+        return RSTEG_ERR_ARGUMENT;
+    }
+    return RSTEG_OK;
+}
+
+// 64-bit permutation key, the position count travels separately in the seed record
+static unsigned long long generateSeed() {
+
+    std::random_device rd;
+    std::uniform_int_distribution<unsigned long long> distribution;
+
+    return distribution(rd);
+}
+
+static std::string getFileExtension(const std::vector<unsigned char>& payload) {
+
+    std::vector<unsigned char> data(4, 0x00);
+    std::copy_n(payload.begin(), std::min<size_t>(4, payload.size()), data.begin());
+
+    if (data[0] == 0x50 && data[1] == 0x4B && data[2] == 0x03 && data[3] == 0x04) {
+        return ".zip";
+    }
+    else if (data[0] == 0xFF && data[1] == 0xD8 && data[2] == 0xFF) {
+        return ".jpg";
+    }
+    else if (data[0] == 0x52 && data[1] == 0x49 && data[2] == 0x46 && data[3] == 0x46) {
+        return ".wav";
+    }
+    else if (data[0] == 0x89 && data[1] == 0x50 && data[2] == 0x4E && data[3] == 0x47) {
+        return ".png";
+    }
+    else if (data[0] == 0x25 && data[1] == 0x50 && data[2] == 0x44 && data[3] == 0x46) {
+        return ".pdf";
+    }
+    else if (data[0] == 0x47 && data[1] == 0x49 && data[2] == 0x46 && data[3] == 0x38) {
+        return ".gif";
+    }
+    else if ((data[0] == 0x49 && data[1] == 0x44 && data[2] == 0x33) ||
+             (data[0] == 0xFF && data[1] == 0xFB) ||
+             (data[0] == 0xFF && data[1] == 0xF3)) {
+        return ".mp3";
+    }
+
+    return ".txt";
+}
+
+static bool isVideoPath(const char* path) {
+    size_t length = strlen(path);
+    return length >= 4 && strcmp(path + length - 4, ".avi") == 0;
+}
+
+RstegStatus rstegProbe(const char* containerPath, RstegProbe& probe) {
+    bool isVideo = isVideoPath(containerPath);
+
+    std::vector<int> info;
+    if (isVideo ? !readVideoInfo(containerPath, info, true) : !readPngInfo(containerPath, info)) {
+        return RSTEG_ERR_CONTAINER;
+    }
+
+    probe.width = info[0];
+    probe.height = info[1];
+    probe.channels = info[2];
+    probe.frames = isVideo ? info[3] : 1;
+    probe.carrierBytes = static_cast<unsigned long long>(probe.width) * probe.height * probe.channels * std::max(0, probe.frames);
+
+    return RSTEG_OK;
+}
+
+unsigned long long rstegCapacity(unsigned long long carrierBytes, int bits) {
+    if (bits < LSB_MIN_BITS || bits > LSB_MAX_BITS) {
+        return 0;
+    }
+    return payloadForPositions(carrierBytes, bits);
+}
+
+static void printHex(std::ostream& out, const char* label, const unsigned char* bytes, size_t length) {
+    out << label;
+    for (size_t i = 0; i < length; ++i) {
+        if (i != 0) {
+            out << ' ';
+        }
+        out << std::hex << std::setw(2) << std::setfill('0') << static_cast<int>(bytes[i]);
+    }
+    out << std::dec << std::endl;
+}
+
+// fresh record for a payload : segmented positions, CTR payload cipher
+static RstegStatus newSeedRecord(unsigned long long payloadSize, const RstegOptions& options, SeedRecord& seedRecord) {
+    int bits = options.bits;
+    StageTimer timer(STAGE_SEED);
+    if (bits < LSB_MIN_BITS || bits > LSB_MAX_BITS) {
+        std::cerr << "Error:    unsupported LSB depth" << std::endl;
+        return RSTEG_ERR_ARGUMENT;
+    }
+
+    if (!parsePositionMode(options.positions, seedRecord.positionMode)) {
+        std::cerr << "Error:    unknown position order " << options.positions << std::endl;
+        return RSTEG_ERR_ARGUMENT;
+    }
+    seedRecord.cipherMode = PAYLOAD_CIPHER_CTR;
+    seedRecord.bits = static_cast<unsigned char>(bits);
+    if (1 != RAND_bytes(seedRecord.iv, sizeof(seedRecord.iv))) {
+        std::cerr << "Error:    unable to generate IV" << std::endl;
+        return RSTEG_ERR_CRYPTO;
+    }
+
+    // CTR keeps the payload size, `bits` payload bits per carrier byte
+    seedRecord.seed = generateSeed();
+    seedRecord.numPositions = positionsForPayload(payloadSize, bits);
+    seedRecord.authenticated = true;
+
+    return RSTEG_OK;
+}
+
+// Fresh record for a payload that is first compressed into `packed` when the
+// options ask for it and it pays off. `packed` is left empty when the payload
+// is embedded as is.
+static RstegStatus preparePayload(const RstegOptions& options, ThreadPool& pool, const unsigned char* payload, unsigned long long payloadSize,
+                                  std::vector<unsigned char>& packed, SeedRecord& seedRecord, std::ostream& progress) {
+    unsigned char compression = PAYLOAD_COMPRESSION_NONE;
+    packed.clear();
+
+    if (parseCompression(options.compression, compression) && compression != PAYLOAD_COMPRESSION_NONE) {
+        if (worthCompressing(payload, payloadSize)) {
+            if (!compressPayload(compression, options.compressionLevel, payload, payloadSize, pool, packed)) {
+                return RSTEG_ERR_IO;
+            }
+            // a saving below 1/64 is not worth the inflate pass on extraction
+            if (packed.size() >= payloadSize - payloadSize / 64) {
+                std::vector<unsigned char>().swap(packed);
+            }
+        }
+
+        if (packed.empty()) {
+            progress << "embed file does not compress, stored as is" << std::endl;
+        } else {
+            progress << std::fixed << std::setprecision(1) << "compressed embed file:   " << static_cast<double>(payloadSize)/1024.0
+                     << " KB -> " << static_cast<double>(packed.size())/1024.0 << " KB" << std::endl;
+        }
+    }
+
+    RstegStatus status = newSeedRecord(packed.empty() ? payloadSize : packed.size(), options, seedRecord);
+    if (status != RSTEG_OK || packed.empty()) {
+        return status;
+    }
+
+    int level = options.compressionLevel;
+    if (level < 0) {
+        level = compression == PAYLOAD_COMPRESSION_ZLIB ? 6 : 3;
+    }
+    seedRecord.compression = compression;
+    seedRecord.compressionLevel = static_cast<unsigned char>(level);
+    seedRecord.plainSize = payloadSize;
+
+    return RSTEG_OK;
+}
+
+// trailer : payload MAC of authenticated records, encrypted seed record, its length byte.
+// `mac` has seen every segment.
+static RstegStatus sealSeedRecord(const SeedRecord& seedRecord, const unsigned char* seedKey, PayloadMac& mac,
+                                  std::vector<unsigned char>& trailer, std::ostream& progress) {
+    StageTimer timer(STAGE_SEED);
+    trailer.clear();
+    if (seedRecord.authenticated) {
+        trailer.resize(PAYLOAD_MAC_SIZE);
+        if (!mac.final(trailer.data())) {
+            return RSTEG_ERR_CRYPTO;
+        }
+    }
+
+    unsigned char seedBytes[SEED_RECORD_MAX_SIZE];
+    int seedBytesLength = packSeedRecord(seedRecord, seedBytes);
+
+    unsigned char encryptedSeed[3 * AES_BLOCK_SIZE];
+    int encryptedSeedLength = encrypt_seed(seedBytes, seedBytesLength, seedKey, seedKey, encryptedSeed);
+    if (encryptedSeedLength < 0) {
+        std::cerr << "Error:    failed to encrypt seed" << std::endl;
+        return RSTEG_ERR_CRYPTO;
+    }
+
+    printHex(progress, "AES-256 encrypted seed bytes:     ", encryptedSeed, encryptedSeedLength);
+
+    trailer.insert(trailer.end(), encryptedSeed, encryptedSeed + encryptedSeedLength);
+    trailer.push_back(static_cast<unsigned char>(encryptedSeedLength));
+
+    return RSTEG_OK;
+}
+
+// the trailer length byte gives the exact ciphertext length, which may end in 0x00
+static RstegStatus openSeedRecord(const std::vector<unsigned char>& trailer, const unsigned char* seedKey, SeedRecord& seedRecord, std::ostream& progress) {
+    StageTimer timer(STAGE_SEED);
+    printHex(progress, "extracted seed:   ", trailer.data(), trailer.size());
+
+    unsigned char seedBytes[3 * AES_BLOCK_SIZE];
+    if (trailer.empty() || trailer.size() > sizeof(seedBytes) || trailer.size() % AES_BLOCK_SIZE != 0) {
+        std::cerr << "Error:    invalid seed length" << std::endl;
+        return RSTEG_ERR_SEED;
+    }
+
+    int seedBytesLength = decrypt_seed(trailer.data(), static_cast<int>(trailer.size()), seedKey, seedKey, seedBytes);
+    if (seedBytesLength < 0) {
+        std::cerr << "Error:    failed to decrypt seed" << std::endl;
+        return RSTEG_ERR_SEED;
+    }
+
+    if (!unpackSeedRecord(seedBytes, seedBytesLength, seedRecord)) {
+        return RSTEG_ERR_SEED;
+    }
+
+    progress << "decrypted seed:   " << seedRecord.seed << std::endl;
+
+    return RSTEG_OK;
+}
+
+// legacy shuffle and unsegmented keyed records : the whole position prefix is resident,
+// `sorted` allows the locality sorted walk of large legacy tables
+static RstegStatus extractInMemory(const unsigned char* carrier, const SeedRecord& seedRecord, const unsigned char* messageKey,
+                                   const PositionCache& cache, ThreadPool& pool, bool sorted, std::vector<unsigned char>& payload,
+                                   std::ostream& progress) {
+    std::vector<unsigned char> extractedBytes;
+
+    if (seedRecord.positionMode == POSITIONS_LEGACY_SHUFFLE) {
+        StageTimer positionTimer(STAGE_POSITIONS, seedRecord.numPositions);
+        auto start = std::chrono::high_resolution_clock::now();
+        std::vector<int> positions;
+        bool cached = loadCachedPositions(cache, seedRecord.seed, seedRecord.numPositions, pool, positions);
+        if (!cached) {
+            progress << "generating randomized embed order from seed ..." << std::endl;
+            positions = generateRandomPositions(seedRecord.seed, seedRecord.numPositions);
+            storeCachedPositions(cache, seedRecord.seed, positions, pool);
+        }
+        auto stop = std::chrono::high_resolution_clock::now();
+        positionTimer.stop();
+
+        auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(stop - start);
+        progress << (cached ? "loaded cached encoding sequence in " : "generated encoding sequence in ") << duration.count() << " ms" << std::endl;
+
+        progress << "decoding file ..." << std::endl;
+        StageTimer extractTimer(STAGE_EXTRACT, positions.size());
+        if (sorted && positions.size() >= LOCALITY_SORT_MIN_POSITIONS) {
+            extractedBytes = decode_file_sorted(carrier, positions);
+        } else {
+            extractedBytes = decode_file_parallel(carrier, positions, pool);
+        }
+    } else {
+        progress << "using keyed permutation embed order from seed ..." << std::endl;
+        KeyedPermutation positions = generateKeyedPositions(seedRecord.seed, seedRecord.numPositions);
+
+        progress << "decoding file ..." << std::endl;
+        StageTimer extractTimer(STAGE_EXTRACT, positions.size());
+        extractedBytes.assign(positions.size() / 4, 0);
+        decode_lsb_parallel(carrier, positions.size(), 0, positions, extractedBytes, pool);
+    }
+
+    StageTimer decryptTimer(STAGE_DECRYPT, extractedBytes.size());
+    if (seedRecord.cipherMode == PAYLOAD_CIPHER_CTR) {
+        // ciphertext and plaintext are exactly position count / 4 bytes, nothing to trim
+        payload = std::move(extractedBytes);
+
+        if (!ctr_crypt(payload.data(), payload.size(), messageKey, seedRecord.iv, payload.data(), pool)) {
+            std::cerr << "Error:    unable to decrypt extracted file" << std::endl;
+            return RSTEG_ERR_CRYPTO;
+        }
+
+        return RSTEG_OK;
+    }
+
+    // CBC records were written with position count / 4 == ciphertext length, and
+    // decrypt strips the PKCS#7 padding, so payloads ending in 0x00 survive
+    if (extractedBytes.empty() || extractedBytes.size() % AES_BLOCK_SIZE != 0 ||
+        decrypt(extractedBytes, extractedBytes.size(), messageKey, messageKey, payload) < 0) {
+        std::cerr << "Error:    unable to decrypt extracted file" << std::endl;
+        return RSTEG_ERR_CRYPTO;
+    }
+
+    return RSTEG_OK;
+}
+
+Rsteg::Rsteg(const RstegOptions& options) : impl(new Impl(options)) {
+    OpenSSL_add_all_algorithms();
+    ERR_load_crypto_strings();
+}
+
+Rsteg::~Rsteg() = default;
+
+RstegStatus Rsteg::embed(unsigned char* carrier, size_t carrierSize, const unsigned char* payload, size_t payloadSize,
+                         const unsigned char* messageKey, const unsigned char* seedKey, std::vector<unsigned char>& trailer) const {
+    if (carrier == nullptr || payload == nullptr || payloadSize == 0 || messageKey == nullptr || seedKey == nullptr) {
+        std::cerr << "Error:    missing container, embed file or key" << std::endl;
+        return RSTEG_ERR_ARGUMENT;
+    }
+
+    SeedRecord seedRecord;
+    std::vector<unsigned char> packed;
+    RstegStatus status = preparePayload(impl->options, impl->pool, payload, payloadSize, packed, seedRecord, impl->progress());
+    if (status != RSTEG_OK) {
+        return status;
+    }
+
+    if (seedRecord.numPositions > carrierSize) {
+        std::cerr << "Error:    insufficient container size" << std::endl;
+        return RSTEG_ERR_CAPACITY;
+    }
+
+    if (!packed.empty()) {
+        payload = packed.data();
+        payloadSize = packed.size();
+    }
+
+    PayloadMac mac(seedRecord, seedKey);
+    SegmentEmbedder embedder(payload, payloadSize, seedRecord, messageKey, impl->pool, nullptr, &mac);
+    if (!embedder.embed(carrier, carrierSize, 0)) {
+        return RSTEG_ERR_CRYPTO;
+    }
+
+    return sealSeedRecord(seedRecord, seedKey, mac, trailer, impl->progress());
+}
+
+RstegStatus Rsteg::extract(const unsigned char* carrier, size_t carrierSize, const unsigned char* trailer, size_t trailerSize,
+                           const unsigned char* messageKey, const unsigned char* seedKey, std::vector<unsigned char>& payload) const {
+    if (carrier == nullptr || trailer == nullptr || messageKey == nullptr || seedKey == nullptr) {
+        std::cerr << "Error:    missing container, seed or key" << std::endl;
+        return RSTEG_ERR_ARGUMENT;
+    }
+
+    std::vector<unsigned char> encryptedSeed;
+    if (!splitSeedBytes(trailer, trailerSize, encryptedSeed)) {
+        return RSTEG_ERR_SEED;
+    }
+
+    SeedRecord seedRecord;
+    RstegStatus status = openSeedRecord(encryptedSeed, seedKey, seedRecord, impl->progress());
+    if (status != RSTEG_OK) {
+        return status;
+    }
+
+    // the MAC sits in front of the encrypted record
+    size_t macOffset = trailerSize - 1 - encryptedSeed.size();
+    if (seedRecord.authenticated && macOffset < PAYLOAD_MAC_SIZE) {
+        std::cerr << "Error:    missing payload MAC" << std::endl;
+        return RSTEG_ERR_SEED;
+    }
+
+    if (carrierSize < seedRecord.numPositions) {
+        std::cerr << "Error:    container is smaller than the embedded sequence" << std::endl;
+        return RSTEG_ERR_CONTAINER;
+    }
+
+    if (!segmentedPositions(seedRecord.positionMode)) {
+        return extractInMemory(carrier, seedRecord, messageKey, impl->positionCache(seedKey), impl->pool, true, payload, impl->progress());
+    }
+
+    payload.clear();
+    if (seedRecord.compression == PAYLOAD_COMPRESSION_NONE) {
+        payload.reserve(seedPayloadSize(seedRecord));
+    }
+
+    auto append = [&](const std::vector<unsigned char>& chunk) {
+        payload.insert(payload.end(), chunk.begin(), chunk.end());
+        return true;
+    };
+
+    PayloadMac mac(seedRecord, seedKey);
+    PayloadInflater inflater(seedRecord.compression);
+    SegmentExtractor extractor(seedRecord, messageKey, impl->pool, [&](const std::vector<unsigned char>& chunk) {
+        return seedRecord.compression == PAYLOAD_COMPRESSION_NONE ? append(chunk) : inflater.write(chunk.data(), chunk.size(), append);
+    }, seedRecord.authenticated ? &mac : nullptr);
+
+    if (!extractor.extract(carrier, carrierSize, 0) || !extractor.complete() ||
+        (seedRecord.compression != PAYLOAD_COMPRESSION_NONE && !inflater.complete(seedRecord.plainSize))) {
+        std::cerr << "Error:    unable to decrypt extracted file" << std::endl;
+        payload.clear();
+        return RSTEG_ERR_CRYPTO;
+    }
+
+    if (seedRecord.authenticated && !mac.verify(trailer + macOffset - PAYLOAD_MAC_SIZE)) {
+        std::cerr << "Error:    payload MAC mismatch, the container was altered" << std::endl;
+        payload.clear();
+        return RSTEG_ERR_CRYPTO;
+    }
+
+    return RSTEG_OK;
+}
+
+RstegStatus Rsteg::embedPng(const unsigned char* png, size_t pngSize, const unsigned char* payload, size_t payloadSize,
+                            const unsigned char* messageKey, const unsigned char* seedKey, std::vector<unsigned char>& output) const {
+    std::pair<std::vector<int>, std::vector<unsigned char>> image;
+    if (png == nullptr) {
+        std::cerr << "Error:    missing container" << std::endl;
+        return RSTEG_ERR_ARGUMENT;
+    }
+    if (!decodeImage(png, pngSize, image)) {
+        return RSTEG_ERR_CONTAINER;
+    }
+
+    std::vector<unsigned char> trailer;
+    RstegStatus status = embed(image.second.data(), image.second.size(), payload, payloadSize, messageKey, seedKey, trailer);
+    if (status != RSTEG_OK) {
+        return status;
+    }
+
+    if (!encodeImage(image.second, image.first[0], image.first[1], image.first[2], impl->pngOptions, trailer, output)) {
+        std::cerr << "Error:    failed to write to container" << std::endl;
+        return RSTEG_ERR_CONTAINER;
+    }
+
+    return RSTEG_OK;
+}
+
+RstegStatus Rsteg::extractPng(const unsigned char* png, size_t pngSize,
+                              const unsigned char* messageKey, const unsigned char* seedKey, std::vector<unsigned char>& payload) const {
+    if (png == nullptr) {
+        std::cerr << "Error:    missing container" << std::endl;
+        return RSTEG_ERR_ARGUMENT;
+    }
+
+    // the seed trailer follows IEND, where the decoder stops
+    std::pair<std::vector<int>, std::vector<unsigned char>> image;
+    if (!decodeImage(png, pngSize, image)) {
+        return RSTEG_ERR_CONTAINER;
+    }
+
+    return extract(image.second.data(), image.second.size(), png, pngSize, messageKey, seedKey, payload);
+}
+
+RstegStatus Rsteg::Impl::embedFile(Image& image, const char* containerPath, const char* payloadPath, const char* outputPath,
+                                   const unsigned char* messageKey, const unsigned char* seedKey, unsigned long long memoryBudget) {
+    std::ostream& progress = this->progress();
+
+    // the embed file is mapped, then encrypted and embedded one segment at a time
+    MappedFile payload;
+    if (!payload.open(payloadPath)) {
+        std::cerr << "Error:    unable to read embed file" << std::endl;
+        return RSTEG_ERR_IO;
+    }
+
+    // videos are streamed frame by frame at embed time, only their geometry is read here
+    bool isVideo = isVideoPath(containerPath);
+    std::vector<int> containerInfo;
+    if (isVideo) {
+        StageTimer timer(STAGE_CONTAINER_READ);
+        if (!readVideoInfo(containerPath, containerInfo)) {
+            return RSTEG_ERR_CONTAINER;
+        }
+    } else if (!readPngInfo(containerPath, containerInfo)) {
+        return RSTEG_ERR_CONTAINER;
+    }
+    unsigned long long frameBytes = static_cast<unsigned long long>(containerInfo[0]) * containerInfo[1] * containerInfo[2];
+    unsigned long long containerSize = isVideo ? frameBytes * std::max(0, containerInfo[3]) : frameBytes;
+
+    // planned from the uncompressed size, before anything large is allocated
+    RstegOptions payloadOptions = options;
+    MemoryPlan plan;
+    plan.budget = memoryBudget;
+    if (memoryBudget != 0) {
+        unsigned char compression = PAYLOAD_COMPRESSION_NONE;
+        MemoryJob job;
+        job.video = isVideo;
+        job.frameBytes = frameBytes;
+        job.pixelBytes = isVideo ? 0 : frameBytes;
+        job.height = containerInfo[1];
+        job.bits = options.bits;
+        job.numPositions = positionsForPayload(payload.size(), options.bits);
+        parsePositionMode(options.positions, job.positionMode);
+        parseCompression(options.compression, compression);
+        job.compressBytes = compression != PAYLOAD_COMPRESSION_NONE ? payload.size() : 0;
+
+        if (!planMemory(job, plan, progress)) {
+            return RSTEG_ERR_MEMORY;
+        }
+        if (!plan.compress) {
+            payloadOptions.compression = "none";
+        }
+    }
+
+    // a compressed payload is held in memory, the mapping is dropped once it is read
+    SeedRecord seedRecord;
+    std::vector<unsigned char> packed;
+    RstegStatus status = preparePayload(payloadOptions, pool, payload.data(), payload.size(), packed, seedRecord, progress);
+    if (status != RSTEG_OK) {
+        return status;
+    }
+    if (!packed.empty()) {
+        payload.release(0, payload.size());
+    }
+
+    unsigned long long numPositions = seedRecord.numPositions;
+
+    progress << std::fixed << std::setprecision(1) << "minimum required container size:   " << static_cast<double>(numPositions)/1024.0 << " KB" << std::endl;
+
+    // a PNG that cannot hold the payload is turned down before it is inflated
+    if (numPositions > containerSize) {
+        std::cerr << "Error:    insufficient container size" << std::endl;
+        return RSTEG_ERR_CAPACITY;
+    }
+
+    SpillBuffer spilled;
+    unsigned char* carrier = nullptr;
+    if (!isVideo) {
+        bool read = plan.spillContainer ? readImage(containerPath, containerInfo, spilled, true) : readImage(containerPath, image);
+        if (!read) {
+            return RSTEG_ERR_CONTAINER;
+        }
+        if (!plan.spillContainer) {
+            containerInfo = image.first;
+        }
+        carrier = plan.spillContainer ? spilled.data() : image.second.data();
+    }
+
+    progress << "file size:    " << std::fixed << std::setprecision(1) << static_cast<double>(payload.size())/1024.0 << " KB" << std::endl;
+    progress << "container size:   " << std::fixed << std::setprecision(1) << static_cast<double>(containerSize)/1024.0 << " KB" << std::endl;
+    progress << "using seed:   " << seedRecord.seed << std::endl;
+
+    // the trailer is sealed once the MAC has seen every segment
+    PayloadMac mac(seedRecord, seedKey);
+    std::vector<unsigned char> trailer;
+    SegmentEmbedder embedder(packed.empty() ? payload.data() : packed.data(), packed.empty() ? payload.size() : packed.size(),
+                             seedRecord, messageKey, pool, packed.empty() ? &payload : nullptr, &mac);
+
+    progress << "encoding file ..." << std::endl;
+
+    if (isVideo) {
+        // read, embed and write one frame at a time
+        bool embedded = true;
+        bool streamed = streamVideo(containerPath, outputPath, numPositions,
+            [&](unsigned char* frame, unsigned long long frameLength, unsigned long long offset) {
+                embedded = embedded && embedder.embed(frame, frameLength, offset);
+            }, [&](std::vector<unsigned char>& bytes) {
+                status = embedded ? sealSeedRecord(seedRecord, seedKey, mac, bytes, progress) : RSTEG_ERR_CRYPTO;
+                return status == RSTEG_OK;
+            }, plan.videoFrames);
+
+        if (!embedded || status != RSTEG_OK) {
+            return RSTEG_ERR_CRYPTO;
+        }
+        if (!streamed) {
+            std::cerr << "Error:    failed to write to container" << std::endl;
+            return RSTEG_ERR_CONTAINER;
+        }
+    } else {
+        // walk the carrier in memory order, segment by segment
+        if (!embedder.embed(carrier, containerSize, 0)) {
+            return RSTEG_ERR_CRYPTO;
+        }
+        status = sealSeedRecord(seedRecord, seedKey, mac, trailer, progress);
+        if (status != RSTEG_OK) {
+            return status;
+        }
+
+        // the seed trailer goes out with the PNG stream, libpng's row writer needs no band buffers
+        PngWriteOptions writeOptions = pngOptions;
+        if (!plan.bandedPng) {
+            writeOptions.pool = nullptr;
+        }
+        if (!writeImage(outputPath, carrier, containerInfo[0], containerInfo[1], containerInfo[2], writeOptions, trailer)) {
+            std::cerr << "Error:    failed to write to container" << std::endl;
+            return RSTEG_ERR_IO;
+        }
+    }
+
+    progress << "seed written to container." << std::endl;
+
+    return RSTEG_OK;
+}
+
+RstegStatus Rsteg::Impl::extractFile(Image& stegoImage, const char* containerPath, const std::string& outputBase,
+                                     const unsigned char* messageKey, const unsigned char* seedKey, std::string& outputPath,
+                                     unsigned long long memoryBudget) {
+    std::ostream& progress = this->progress();
+
+    std::vector<unsigned char> encryptedSeed;
+    if (!decodeSeedBytes(containerPath, encryptedSeed)) {
+        return RSTEG_ERR_SEED;
+    }
+
+    // every embed position lies below the position count carried by the seed,
+    // only the frames covering that prefix have to be decoded
+    SeedRecord seedRecord;
+    RstegStatus status = openSeedRecord(encryptedSeed, seedKey, seedRecord, progress);
+    if (status != RSTEG_OK) {
+        return status;
+    }
+
+    unsigned char tag[PAYLOAD_MAC_SIZE];
+    if (seedRecord.authenticated && !readTrailerPrefix(containerPath, encryptedSeed.size(), tag, sizeof(tag))) {
+        return RSTEG_ERR_SEED;
+    }
+
+    bool isVideo = isVideoPath(containerPath);
+
+    MemoryPlan plan;
+    plan.budget = memoryBudget;
+    std::vector<int> containerInfo;
+    if (memoryBudget != 0) {
+        if (isVideo ? !readVideoInfo(containerPath, containerInfo, true) : !readPngInfo(containerPath, containerInfo)) {
+            return RSTEG_ERR_CONTAINER;
+        }
+
+        MemoryJob job;
+        job.embed = false;
+        job.video = isVideo;
+        job.frameBytes = static_cast<unsigned long long>(containerInfo[0]) * containerInfo[1] * containerInfo[2];
+        job.pixelBytes = isVideo ? 0 : job.frameBytes;
+        job.height = containerInfo[1];
+        job.numPositions = seedRecord.numPositions;
+        job.positionMode = seedRecord.positionMode;
+        job.cipherMode = seedRecord.cipherMode;
+        job.bits = seedRecord.bits;
+        job.inflate = seedRecord.compression != PAYLOAD_COMPRESSION_NONE;
+
+        if (!planMemory(job, plan, progress)) {
+            return RSTEG_ERR_MEMORY;
+        }
+    }
+
+    // a spilled container lives in a temporary file mapping instead of stegoImage
+    SpillBuffer spilled;
+
+    if (!segmentedPositions(seedRecord.positionMode)) {
+        bool read = true;
+        if (!plan.spillContainer) {
+            read = isVideo ? readVideo(containerPath, stegoImage, seedRecord.numPositions) : readImage(containerPath, stegoImage);
+        } else if (isVideo) {
+            // only the embedded prefix is copied out of the frames
+            read = spilled.allocate(seedRecord.numPositions, true) && scanVideo(containerPath, seedRecord.numPositions,
+                [&](const unsigned char* frame, unsigned long long frameLength, unsigned long long offset) {
+                    memcpy(spilled.data() + offset, frame, std::min(frameLength, seedRecord.numPositions - offset));
+                }, plan.videoFrames);
+        } else {
+            read = readImage(containerPath, containerInfo, spilled, true);
+        }
+        if (!read) {
+            return RSTEG_ERR_CONTAINER;
+        }
+
+        const unsigned char* carrier = plan.spillContainer ? spilled.data() : stegoImage.second.data();
+        unsigned long long carrierSize = plan.spillContainer ? spilled.size() : stegoImage.second.size();
+        if (carrierSize < seedRecord.numPositions) {
+            std::cerr << "Error:    container is smaller than the embedded sequence" << std::endl;
+            return RSTEG_ERR_CONTAINER;
+        }
+
+        std::vector<unsigned char> payload;
+        status = extractInMemory(carrier, seedRecord, messageKey, positionCache(seedKey), pool, plan.sortedLegacy, payload, progress);
+        if (status != RSTEG_OK) {
+            return status;
+        }
+
+        outputPath = outputBase + getFileExtension(payload);
+
+        StageTimer timer(STAGE_OUTPUT_WRITE, payload.size());
+        OutputFile outputFile;
+        if (!outputFile.open(outputPath.c_str()) || !outputFile.writeAt(payload.data(), payload.size(), 0) || !outputFile.close()) {
+            std::cerr << "Error:    unable to write " << outputPath << std::endl;
+            return RSTEG_ERR_IO;
+        }
+
+        return RSTEG_OK;
+    }
+
+    // extract, decrypt ( and inflate ) and write one segment at a time into an
+    // output sized up front, the first segment names it. Segments land before the
+    // MAC is checked, so the output only takes its name once everything verifies.
+    StagedOutputFile outputFile;
+    unsigned long long written = 0;
+    bool writeFailed = false;
+    bool compressed = seedRecord.compression != PAYLOAD_COMPRESSION_NONE;
+    outputPath.clear();
+
+    auto write = [&](const std::vector<unsigned char>& chunk) {
+        StageTimer timer(STAGE_OUTPUT_WRITE, chunk.size());
+        if (outputPath.empty()) {
+            outputPath = outputBase + getFileExtension(chunk);
+            // an inflated output grows as it is written, its size is only trusted once the stream checks out
+            if (!outputFile.open(outputPath) || (!compressed && !outputFile.resize(seedPayloadSize(seedRecord)))) {
+                std::cerr << "Error:    unable to write " << outputPath << std::endl;
+                writeFailed = true;
+                return false;
+            }
+        }
+
+        bool ok = outputFile.writeAt(chunk.data(), chunk.size(), written);
+        written += chunk.size();
+        if (!ok && !writeFailed) {
+            std::cerr << "Error:    unable to write " << outputPath << std::endl;
+        }
+        writeFailed = writeFailed || !ok;
+        return ok;
+    };
+
+    PayloadMac mac(seedRecord, seedKey);
+    PayloadInflater inflater(seedRecord.compression);
+    SegmentExtractor extractor(seedRecord, messageKey, pool, [&](const std::vector<unsigned char>& chunk) {
+        return compressed ? inflater.write(chunk.data(), chunk.size(), write) : write(chunk);
+    }, seedRecord.authenticated ? &mac : nullptr);
+
+    progress << "decoding file ..." << std::endl;
+
+    bool read = true;
+    bool extracted = true;
+    if (isVideo) {
+        read = scanVideo(containerPath, seedRecord.numPositions,
+            [&](const unsigned char* frame, unsigned long long frameLength, unsigned long long offset) {
+                extracted = extracted && extractor.extract(frame, frameLength, offset);
+            }, plan.videoFrames);
+    } else {
+        read = plan.spillContainer ? readImage(containerPath, containerInfo, spilled, true) : readImage(containerPath, stegoImage);
+        const unsigned char* carrier = plan.spillContainer ? spilled.data() : stegoImage.second.data();
+        unsigned long long carrierSize = plan.spillContainer ? spilled.size() : stegoImage.second.size();
+        if (read && carrierSize < seedRecord.numPositions) {
+            std::cerr << "Error:    container is smaller than the embedded sequence" << std::endl;
+            read = false;
+        }
+        extracted = read && extractor.extract(carrier, carrierSize, 0);
+    }
+
+    if (writeFailed) {
+        return RSTEG_ERR_IO;
+    }
+    if (!read) {
+        return RSTEG_ERR_CONTAINER;
+    }
+    if (!extracted || !extractor.complete() || (compressed && !inflater.complete(seedRecord.plainSize))) {
+        std::cerr << "Error:    unable to extract the embedded file" << std::endl;
+        return RSTEG_ERR_CRYPTO;
+    }
+
+    if (seedRecord.authenticated && !mac.verify(tag)) {
+        std::cerr << "Error:    payload MAC mismatch, the container was altered" << std::endl;
+        return RSTEG_ERR_CRYPTO;
+    }
+
+    StageTimer timer(STAGE_OUTPUT_WRITE);
+    if (!outputFile.commit()) {
+        std::cerr << "Error:    unable to write " << outputPath << std::endl;
+        return RSTEG_ERR_IO;
+    }
+
+    return RSTEG_OK;
+}
+
+RstegStatus Rsteg::embedFile(const char* containerPath, const char* payloadPath, const char* outputPath,
+                             const unsigned char* messageKey, const unsigned char* seedKey, RstegStats* stats) const {
+    Image image;
+    return withStats(stats, [&] {
+        return impl->embedFile(image, containerPath, payloadPath, outputPath, messageKey, seedKey, impl->options.maxMemory);
+    });
+}
+
+RstegStatus Rsteg::extractFile(const char* containerPath, const std::string& outputBase,
+                               const unsigned char* messageKey, const unsigned char* seedKey, std::string& outputPath,
+                               RstegStats* stats) const {
+    Image stegoImage;
+    return withStats(stats, [&] {
+        return impl->extractFile(stegoImage, containerPath, outputBase, messageKey, seedKey, outputPath, impl->options.maxMemory);
+    });
+}
+
+void Rsteg::batch(const std::vector<RstegJob>& jobs, const unsigned char* messageKey, const unsigned char* seedKey,
+                  std::vector<RstegJobResult>& results) const {
+    results.assign(jobs.size(), RstegJobResult());
+
+    unsigned int runners = impl->options.jobs != 0 ? impl->options.jobs : impl->pool.size();
+    runners = static_cast<unsigned int>(std::min<size_t>(runners, jobs.size()));
+
+    // runners hold their jobs' buffers at the same time, each plans within its share
+    unsigned long long memoryBudget = impl->options.maxMemory == 0 ? 0 : std::max(1ULL, impl->options.maxMemory / std::max(1u, runners));
+
+    // runners claim the next job as they free up, a slow container never holds
+    // back the rest of the manifest. While a runner waits on its own parallel
+    // sections it drains pool tasks queued by the others.
+    std::atomic<size_t> next(0);
+    auto run = [&] {
+        Image image;
+        for (size_t i = next.fetch_add(1); i < jobs.size(); i = next.fetch_add(1)) {
+            const RstegJob& job = jobs[i];
+            RstegJobResult& result = results[i];
+
+            auto start = std::chrono::steady_clock::now();
+            if (job.mode == RSTEG_JOB_EMBED) {
+                result.status = impl->embedFile(image, job.container.c_str(), job.payload.c_str(), job.output.c_str(), messageKey, seedKey,
+                                                memoryBudget);
+                result.outputPath = job.output;
+            } else {
+                result.status = impl->extractFile(image, job.container.c_str(), job.output, messageKey, seedKey, result.outputPath,
+                                                  memoryBudget);
+            }
+            auto stop = std::chrono::steady_clock::now();
+
+            result.seconds = std::chrono::duration<double>(stop - start).count();
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (unsigned int i = 1; i < runners; ++i) {
+        threads.emplace_back(run);
+    }
+    run();
+    for (auto& thread : threads) {
+        thread.join();
+    }
+}
@@ -0,0 +1,158 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <cstddef>
+
+// librsteg : embed / extract encrypted payloads in PNG and AVI containers.
+// Every call reports a status instead of exiting, keys are passed as raw bytes
+// and an Rsteg instance may be shared by concurrent callers. The cause of a
+// failure is written to stderr once, by the library, callers only act on the status.
+
+enum RstegStatus {
+    RSTEG_OK = 0,
+    RSTEG_ERR_ARGUMENT,     // bad options, key or empty payload
+    RSTEG_ERR_IO,           // file could not be read or written
+    RSTEG_ERR_CONTAINER,    // container could not be decoded or encoded
+    RSTEG_ERR_CAPACITY,     // payload does not fit the container
+    RSTEG_ERR_SEED,         // missing, corrupt or undecryptable seed trailer
+    RSTEG_ERR_CRYPTO,       // payload encryption or decryption failed, or its MAC did not match
+    RSTEG_ERR_MEMORY        // job does not fit RstegOptions::maxMemory
+};
+
+const char* rstegStatusMessage(RstegStatus status);
+
+const size_t RSTEG_KEY_SIZE = 32;
+
+// pipeline stages timed for RstegStats, in report order
+enum RstegStage {
+    RSTEG_STAGE_CONTAINER_READ,
+    RSTEG_STAGE_KEY_LOAD,           // filled in by callers that read key files
+    RSTEG_STAGE_SEED,               // seed record generation / encryption / decryption
+    RSTEG_STAGE_POSITIONS,
+    RSTEG_STAGE_ENCRYPT,
+    RSTEG_STAGE_EMBED,
+    RSTEG_STAGE_CONTAINER_WRITE,
+    RSTEG_STAGE_TRAILER_WRITE,
+    RSTEG_STAGE_TRAILER_READ,
+    RSTEG_STAGE_EXTRACT,
+    RSTEG_STAGE_DECRYPT,
+    RSTEG_STAGE_OUTPUT_WRITE,
+    RSTEG_STAGE_COMPRESS,           // optional payload compression ahead of encryption
+    RSTEG_STAGE_DECOMPRESS,
+    RSTEG_STAGE_COUNT
+};
+
+const char* rstegStageName(RstegStage stage);
+
+// wall time and bytes per stage, accumulated over the calls they are passed to
+struct RstegStats {
+    unsigned long long ns[RSTEG_STAGE_COUNT] = {};
+    unsigned long long bytes[RSTEG_STAGE_COUNT] = {};
+};
+
+struct RstegOptions {
+    unsigned int threads = 1;               // embed / extract / cipher / PNG threads
+    int pngLevel = -1;                      // deflate level 0 - 9, -1 zlib default
+    std::string pngFilter = "adaptive";     // none | sub | up | avg | paeth | adaptive
+    bool verbose = false;                   // progress lines on stdout
+    unsigned int jobs = 0;                  // concurrent batch jobs, 0 : one per thread
+    int bits = 2;                           // carrier LSBs per byte on embed, 1 - 4
+    std::string positions = "keyed";        // embed order, keyed ( Feistel, no table ) | shuffle ( Philox table )
+    std::string compression = "none";       // none | zlib | zstd, skipped for incompressible payloads
+    int compressionLevel = -1;              // zlib 0 - 9, zstd 1 - 22, -1 backend default
+    std::string positionCache;              // directory caching legacy position tables, empty : off
+    unsigned long long positionCacheBytes = 1ULL << 30;     // LRU budget of that directory
+    unsigned long long maxMemory = 0;       // peak bytes per file job, split across batch runners, 0 : unlimited
+};
+
+enum RstegJobMode {
+    RSTEG_JOB_EMBED,
+    RSTEG_JOB_EXTRACT
+};
+
+// one line of a batch manifest
+struct RstegJob {
+    RstegJobMode mode = RSTEG_JOB_EMBED;
+    std::string container;      // input container
+    std::string payload;        // embed file [ embed ]
+    std::string output;         // output container [ embed ], output base [ extract ]
+};
+
+struct RstegJobResult {
+    RstegStatus status = RSTEG_OK;
+    std::string outputPath;
+    double seconds = 0.0;
+};
+
+// container geometry read from headers only, nothing is decoded
+struct RstegProbe {
+    int width = 0;
+    int height = 0;
+    int channels = 0;                       // 8-bit samples per pixel as decoded for embedding
+    int frames = 1;                         // 1 for .png
+    unsigned long long carrierBytes = 0;    // width * height * channels * frames
+};
+
+class Rsteg {
+public:
+    explicit Rsteg(const RstegOptions& options = RstegOptions());
+    ~Rsteg();
+
+    Rsteg(const Rsteg&) = delete;
+    Rsteg& operator=(const Rsteg&) = delete;
+
+    // Raw carrier bytes ( decoded pixels or frames ). The payload is embedded in
+    // place and `trailer` receives the payload MAC and encrypted seed record that extract needs.
+    RstegStatus embed(unsigned char* carrier, size_t carrierSize, const unsigned char* payload, size_t payloadSize,
+                      const unsigned char* messageKey, const unsigned char* seedKey, std::vector<unsigned char>& trailer) const;
+
+    // `trailer` as embed returned it, or any tail of a container ending in its trailer
+    RstegStatus extract(const unsigned char* carrier, size_t carrierSize, const unsigned char* trailer, size_t trailerSize,
+                        const unsigned char* messageKey, const unsigned char* seedKey, std::vector<unsigned char>& payload) const;
+
+    // PNG files held in memory, the output carries its seed trailer like files written by embedFile
+    RstegStatus embedPng(const unsigned char* png, size_t pngSize, const unsigned char* payload, size_t payloadSize,
+                         const unsigned char* messageKey, const unsigned char* seedKey, std::vector<unsigned char>& output) const;
+
+    RstegStatus extractPng(const unsigned char* png, size_t pngSize,
+                           const unsigned char* messageKey, const unsigned char* seedKey, std::vector<unsigned char>& payload) const;
+
+    // .png / .avi containers on disk, payloads streamed segment by segment
+    RstegStatus embedFile(const char* containerPath, const char* payloadPath, const char* outputPath,
+                          const unsigned char* messageKey, const unsigned char* seedKey, RstegStats* stats = nullptr) const;
+
+    // writes outputBase + an extension guessed from the payload, returned in outputPath
+    RstegStatus extractFile(const char* containerPath, const std::string& outputBase,
+                            const unsigned char* messageKey, const unsigned char* seedKey, std::string& outputPath,
+                            RstegStats* stats = nullptr) const;
+
+    // Run every job with one key pair. Jobs are claimed one at a time by
+    // `options.jobs` runners sharing the worker pool, so the decode, embed and
+    // encode stages of different jobs overlap. Per job outcomes land in `results`.
+    void batch(const std::vector<RstegJob>& jobs, const unsigned char* messageKey, const unsigned char* seedKey,
+               std::vector<RstegJobResult>& results) const;
+
+private:
+    struct Impl;
+    std::unique_ptr<Impl> impl;
+};
+
+// hex encoded 256-bit key file
+RstegStatus rstegReadKeyFile(const char* path, unsigned char* key);
+
+// peak resident set of the process in bytes, 0 where unsupported
+unsigned long long rstegPeakMemory();
+
+// process wide LSB kernel selection : auto | scalar | sse4.1 | avx2 | avx512
+bool rstegSetSimdLevel(const std::string& level);
+
+// PNG IHDR ( plus tRNS ) or AVI stream properties of a .png / .avi container
+RstegStatus rstegProbe(const char* containerPath, RstegProbe& probe);
+
+// largest embed file that fits `carrierBytes` at `bits` LSBs per byte, 0 for unsupported depths
+unsigned long long rstegCapacity(unsigned long long carrierBytes, int bits);
+
+// RSTEG_ERR_ARGUMENT with a message on stderr for out of range options
+RstegStatus rstegCheckOptions(const RstegOptions& options);
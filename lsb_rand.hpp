@@ -1,106 +1,533 @@
 #include <random>
-#include <bitset>
+#include <atomic>
+#include <cstdint>
+#include <type_traits>
+#include "lsb_simd.hpp"
+#include "thread_pool.hpp"
+
+// seed trailer formats
+//  v1 : 8 byte decimal packed seed (legacy, std::shuffle positions)
+//  v2 : [ version ][ position mode ][ 8 byte decimal packed seed ]
+//  v3 : [ version ][ position mode ][ 8 byte key ][ 8 byte position count ]
+//  v4 : [ version ][ position mode ][ payload cipher ][ 8 byte key ][ 8 byte position count ][ 16 byte IV ]
+//  v5 : [ version ][ position mode ][ payload cipher ][ LSB depth ][ 8 byte key ][ 8 byte position count ][ 16 byte IV ]
+//  v6 : [ version ][ position mode ][ payload cipher ][ LSB depth ][ compression ][ level ][ 8 byte key ]
+//       [ 8 byte position count ][ 16 byte IV ][ 8 byte uncompressed size ]
+// v1 - v4 embed 2 bits per carrier byte, v5 is only written for other depths and
+// v6 only for compressed payloads
+// decimal packed seeds cap the position count at 8-9 digits, v3 addresses 64-bit containers
+// v1 - v3 payloads are AES-256-CBC keyed and IV-ed with the message key
+// v4 - v6 version bytes carry SEED_FLAG_MAC when the trailer holds a payload MAC
+// ahead of the encrypted record, segmented records only
+const unsigned char SEED_FORMAT_V2 = 2;
+const unsigned char SEED_FORMAT_V3 = 3;
+const unsigned char SEED_FORMAT_V4 = 4;
+const unsigned char SEED_FORMAT_V5 = 5;
+const unsigned char SEED_FORMAT_V6 = 6;
+const unsigned char SEED_FLAG_MAC = 0x80;
+const int SEED_RECORD_V1_SIZE = 8;
+const int SEED_RECORD_V2_SIZE = 10;
+const int SEED_RECORD_V3_SIZE = 18;
+const int SEED_RECORD_V4_SIZE = 35;
+const int SEED_RECORD_V5_SIZE = 36;
+const int SEED_RECORD_V6_SIZE = 46;
+const int SEED_RECORD_MAX_SIZE = SEED_RECORD_V6_SIZE;
+
+const unsigned char POSITIONS_LEGACY_SHUFFLE = 0;
+const unsigned char POSITIONS_KEYED_PERMUTATION = 1;
+const unsigned char POSITIONS_SEGMENTED_PERMUTATION = 2;
+const unsigned char POSITIONS_SEGMENTED_SHUFFLE = 3;
+
+// modes embedded and extracted segment by segment, with a CTR payload
+inline bool segmentedPositions(unsigned char mode) {
+    return mode == POSITIONS_SEGMENTED_PERMUTATION || mode == POSITIONS_SEGMENTED_SHUFFLE;
+}
 
-void encode_lsb(std::vector<unsigned char>& imageData, std::vector<unsigned char>& fileData, std::vector<int>& positions) {
-	int b = 0;
-    int c = 1;
-    int shift = 6;
-    bool err = false;
+// embed order names of RstegOptions::positions
+inline bool parsePositionMode(const std::string& name, unsigned char& mode) {
+    if (name == "keyed") {
+        mode = POSITIONS_SEGMENTED_PERMUTATION;
+    } else if (name == "shuffle") {
+        mode = POSITIONS_SEGMENTED_SHUFFLE;
+    } else {
+        return false;
+    }
 
-    std::vector<unsigned char>copyofData = fileData;
-    std::vector<unsigned char>checkbits;
-    unsigned char currentByte = 0x00;
+    return true;
+}
 
-    std::cout << "encoding file ..." << std::endl;
+// carrier LSBs per position, 2 for every record before v5
+const int LSB_DEFAULT_BITS = 2;
+const int LSB_MIN_BITS = 1;
+const int LSB_MAX_BITS = 4;
 
-	for (auto position : positions)
-	{
-		unsigned char val = imageData[position];
+// segmented mode : payload segment k ( segmentPayloadBytes, the last one shorter )
+// fills carrier positions [ k * SEGMENT_POSITIONS, ... ) under its own keyed permutation,
+// so a segment is embedded or extracted with only its own payload bytes resident
+const unsigned long long SEGMENT_POSITIONS = 1ULL << 26;
+
+// 16 MiB at depth 2, always a whole number of AES blocks
+inline unsigned long long segmentPayloadBytes(int bits) {
+    return SEGMENT_POSITIONS * bits / 8;
+}
+
+// positions needed for `bytes` of payload, the last crumb may be partly padding
+inline unsigned long long positionsForPayload(unsigned long long bytes, int bits) {
+    return (8 * bytes + bits - 1) / bits;
+}
+
+inline unsigned long long payloadForPositions(unsigned long long positions, int bits) {
+    return positions * bits / 8;
+}
 
-        if(b>=fileData.size()) {
-            std::cerr << "Error:    past eof error" << std::endl;
-            break;
+// fn( std::integral_constant<int, Bits> ) for a depth known at run time, so the
+// kernels are specialized once per call rather than branching per crumb
+template <typename Fn>
+void withLsbBits(int bits, Fn&& fn) {
+    switch (bits) {
+        case 1:  fn(std::integral_constant<int, 1>()); break;
+        case 3:  fn(std::integral_constant<int, 3>()); break;
+        case 4:  fn(std::integral_constant<int, 4>()); break;
+        default: fn(std::integral_constant<int, 2>()); break;
+    }
+}
+
+const unsigned char PAYLOAD_CIPHER_CBC = 0;
+const unsigned char PAYLOAD_CIPHER_CTR = 1;
+
+// applied before encryption, the embedded stream is the compressed one
+const unsigned char PAYLOAD_COMPRESSION_NONE = 0;
+const unsigned char PAYLOAD_COMPRESSION_ZLIB = 1;
+const unsigned char PAYLOAD_COMPRESSION_ZSTD = 2;
+
+struct SeedRecord {
+    unsigned long long seed = 0;
+    unsigned long long numPositions = 0;
+    unsigned char positionMode = POSITIONS_LEGACY_SHUFFLE;
+    unsigned char cipherMode = PAYLOAD_CIPHER_CBC;
+    unsigned char bits = LSB_DEFAULT_BITS;
+    unsigned char compression = PAYLOAD_COMPRESSION_NONE;
+    unsigned char compressionLevel = 0;
+    unsigned long long plainSize = 0;       // compressed records only
+    unsigned char iv[16] = {};
+    bool authenticated = false;             // trailer holds a payload MAC
+};
+
+// size of the file extraction reproduces, segmented records only
+inline unsigned long long seedPayloadSize(const SeedRecord& seedRecord) {
+    if (seedRecord.compression != PAYLOAD_COMPRESSION_NONE) {
+        return seedRecord.plainSize;
+    }
+    return payloadForPositions(seedRecord.numPositions, seedRecord.bits);
+}
+
+// Keyed pseudorandom permutation of [0, n) evaluated on demand.
+// Balanced Feistel network over the smallest power-of-four domain >= n, values
+// falling outside [0, n) are cycle-walked back in. No table, O(1) memory.
+class KeyedPermutation {
+public:
+    KeyedPermutation(unsigned long long key, unsigned long long n) : n(n) {
+        halfBits = 1;
+        while (halfBits < 31 && (1ULL << (2 * halfBits)) < n) {
+            ++halfBits;
         }
+        halfMask = (1ULL << halfBits) - 1;
 
-		if (c % 5 == 0) {
-			for (auto checkbit : checkbits) {
-				unsigned char tmp1 = checkbit;
-				currentByte |= ((tmp1 & 0x03) << shift);
-				shift -= 2;
-			}
+        unsigned long long state = key;
+        for (int r = 0; r < FEISTEL_ROUNDS; ++r) {
+            roundKeys[r] = feistelMix(state += 0x9E3779B97F4A7C15ULL);
+        }
+    }
 
-            std::bitset<16> x(currentByte);
-            std::bitset<16> y(copyofData[b]);
+    unsigned long long operator[](unsigned long long i) const {
+        do {
+            i = encipher(i);
+        } while (i >= n);
+        return i;
+    }
+
+    // index i such that (*this)[i] == position
+    unsigned long long inverse(unsigned long long position) const {
+        return feistelInverse(params(), position);
+    }
+
+    // inverse of `count` consecutive positions through the dispatched kernel
+    void inverseBatch(unsigned long long first, size_t count, unsigned long long* out) const {
+        lsbKernels().inverse(params(), first, count, out);
+    }
+
+    unsigned long long size() const { return n; }
+
+private:
+    unsigned long long n;
+    int halfBits;
+    unsigned long long halfMask;
+    unsigned long long roundKeys[FEISTEL_ROUNDS];
+
+    FeistelParams params() const {
+        return FeistelParams{roundKeys, halfBits, halfMask, n};
+    }
+
+    unsigned long long encipher(unsigned long long x) const {
+        unsigned long long left = x >> halfBits;
+        unsigned long long right = x & halfMask;
+        for (int r = 0; r < FEISTEL_ROUNDS; ++r) {
+            unsigned long long tmp = right;
+            right = left ^ (feistelMix(right ^ roundKeys[r]) & halfMask);
+            left = tmp;
+        }
+        return (left << halfBits) | right;
+    }
+};
+
+// Philox4x32-10 ( Salmon et al., SC 2011 ). Block `counter` of `stream` is four
+// 32-bit words computed on its own, so any thread can draw any part of a stream.
+class Philox {
+public:
+    explicit Philox(unsigned long long key) : key{static_cast<uint32_t>(key), static_cast<uint32_t>(key >> 32)} {}
+
+    void block(unsigned long long stream, unsigned long long counter, uint32_t* out) const {
+        uint32_t x0 = static_cast<uint32_t>(counter);
+        uint32_t x1 = static_cast<uint32_t>(counter >> 32);
+        uint32_t x2 = static_cast<uint32_t>(stream);
+        uint32_t x3 = static_cast<uint32_t>(stream >> 32);
+        uint32_t k0 = key[0];
+        uint32_t k1 = key[1];
+
+        for (int round = 0; round < 10; ++round) {
+            uint64_t p0 = 0xD2511F53ULL * x0;
+            uint64_t p1 = 0xCD9E8D57ULL * x2;
+            x0 = static_cast<uint32_t>(p1 >> 32) ^ x1 ^ k0;
+            x1 = static_cast<uint32_t>(p1);
+            x2 = static_cast<uint32_t>(p0 >> 32) ^ x3 ^ k1;
+            x3 = static_cast<uint32_t>(p0);
+            k0 += 0x9E3779B9;
+            k1 += 0xBB67AE85;
+        }
+
+        out[0] = x0;
+        out[1] = x1;
+        out[2] = x2;
+        out[3] = x3;
+    }
 
-            if(currentByte != copyofData[b]) {
-                std::cout << "Error:    encoding expected:  " << x << "     got: " << y << std::endl;
-                err = true;
+private:
+    uint32_t key[2];
+};
+
+// Uniform random permutation of [0, n), n <= 2^32, built in parallel yet
+// identical for any thread count : every position draws a bucket from Philox
+// stream 0 and is scattered to it in position order, then each bucket gets a
+// Fisher-Yates pass on its own stream ( bucket + 1 ). Fixed bucket and chunk
+// sizes keep the work split independent of the pool. The table is kept as the
+// inverse ( carrier position -> crumb ), the direction the window functions walk,
+// at 4 bytes per position.
+const unsigned long long SHUFFLE_BUCKET_POSITIONS = 1 << 16;
+const unsigned long long SHUFFLE_CHUNK_POSITIONS = 1 << 16;
+
+class ShuffledPermutation {
+public:
+    // reuses the table of the previous build
+    void build(unsigned long long key, unsigned long long n, ThreadPool& pool) {
+        Philox rng(key);
+        unsigned long long buckets = std::max(1ULL, (n + SHUFFLE_BUCKET_POSITIONS - 1) / SHUFFLE_BUCKET_POSITIONS);
+        unsigned long long chunks = (n + SHUFFLE_CHUNK_POSITIONS - 1) / SHUFFLE_CHUNK_POSITIONS;
+
+        // bucket of crumbs [first, last), word i % 4 of block i / 4
+        auto forBuckets = [&](unsigned long long first, unsigned long long last, auto fn) {
+            uint32_t words[4];
+            for (unsigned long long i = first; i < last; ++i) {
+                if (i % 4 == 0 || i == first) {
+                    rng.block(0, i / 4, words);
+                }
+                fn(i, static_cast<size_t>((static_cast<uint64_t>(words[i % 4]) * buckets) >> 32));
+            }
+        };
+
+        std::vector<uint32_t> offsets(chunks * buckets, 0);
+        pool.parallelFor(chunks, 1, [&](unsigned long long first, unsigned long long last) {
+            for (unsigned long long chunk = first; chunk < last; ++chunk) {
+                uint32_t* counts = offsets.data() + chunk * buckets;
+                forBuckets(chunk * SHUFFLE_CHUNK_POSITIONS, std::min(n, (chunk + 1) * SHUFFLE_CHUNK_POSITIONS),
+                           [&](unsigned long long, size_t bucket) { ++counts[bucket]; });
             }
+        });
+
+        // bucket major exclusive prefix sum : chunk c writes bucket b from offsets[c * buckets + b]
+        std::vector<unsigned long long> bucketStart(buckets + 1, n);
+        unsigned long long total = 0;
+        for (unsigned long long bucket = 0; bucket < buckets; ++bucket) {
+            bucketStart[bucket] = total;
+            for (unsigned long long chunk = 0; chunk < chunks; ++chunk) {
+                uint32_t count = offsets[chunk * buckets + bucket];
+                offsets[chunk * buckets + bucket] = static_cast<uint32_t>(total);
+                total += count;
+            }
+        }
+
+        table.resize(n);
+        pool.parallelFor(chunks, 1, [&](unsigned long long first, unsigned long long last) {
+            for (unsigned long long chunk = first; chunk < last; ++chunk) {
+                uint32_t* cursor = offsets.data() + chunk * buckets;
+                forBuckets(chunk * SHUFFLE_CHUNK_POSITIONS, std::min(n, (chunk + 1) * SHUFFLE_CHUNK_POSITIONS),
+                           [&](unsigned long long i, size_t bucket) { table[cursor[bucket]++] = static_cast<uint32_t>(i); });
+            }
+        });
 
-            ++b;
-            c = 1;
-            shift = 6;
-            checkbits.clear();
-            currentByte = 0x00;
-		}
+        pool.parallelFor(buckets, 1, [&](unsigned long long first, unsigned long long last) {
+            for (unsigned long long bucket = first; bucket < last; ++bucket) {
+                shuffleBucket(rng, bucket + 1, table.data() + bucketStart[bucket], bucketStart[bucket + 1] - bucketStart[bucket]);
+            }
+        });
+    }
+
+    unsigned long long inverse(unsigned long long position) const {
+        return table[position];
+    }
 
-		val &= 0xFC;
-		auto tmp = fileData[b];
-		val |= ((tmp & 0xc0) >> 6);
+    void inverseBatch(unsigned long long first, size_t count, unsigned long long* out) const {
+        std::copy(table.begin() + first, table.begin() + first + count, out);
+    }
 
-        unsigned char dataToWrite = static_cast<unsigned char>((tmp & 0xc0) >> 6);
+    unsigned long long size() const { return table.size(); }
 
-		checkbits.push_back(val);
+private:
+    std::vector<uint32_t> table;
 
-		fileData[b] <<= 2;
+    // Fisher-Yates with Lemire's multiply-shift bounded draws, sequential words of `stream`
+    static void shuffleBucket(const Philox& rng, unsigned long long stream, uint32_t* items, unsigned long long count) {
+        uint32_t words[4];
+        unsigned long long drawn = 0;
+        auto next = [&] {
+            if (drawn % 4 == 0) {
+                rng.block(stream, drawn / 4, words);
+            }
+            return words[drawn++ % 4];
+        };
+
+        for (unsigned long long j = count; j > 1; --j) {
+            uint32_t range = static_cast<uint32_t>(j);
+            uint64_t m = static_cast<uint64_t>(next()) * range;
+            if (static_cast<uint32_t>(m) < range) {
+                uint32_t threshold = (0u - range) % range;
+                while (static_cast<uint32_t>(m) < threshold) {
+                    m = static_cast<uint64_t>(next()) * range;
+                }
+            }
+            std::swap(items[j - 1], items[m >> 32]);
+        }
+    }
+};
+
+// positions handled per kernel call by the window functions
+const size_t LSB_BATCH = 512;
+
+// Embed into a window of the carrier, carrier[0] being position `offset` of the
+// full container. Carrier bytes are walked in memory order and each pulls its
+// crumb through the inverse permutation, so windows can be processed one at a time.
+template <int Bits = LSB_DEFAULT_BITS, typename Positions = KeyedPermutation>
+void encode_lsb_window(unsigned char* carrier, unsigned long long length, unsigned long long offset,
+                       const std::vector<unsigned char>& fileData, const Positions& positions) {
+    unsigned long long end = std::min(offset + length, positions.size());
+    const LsbKernels& kernels = lsbKernels();
+
+    unsigned long long crumbs[LSB_BATCH];
+    unsigned char bits[LSB_BATCH];
+
+    for (unsigned long long position = offset; position < end; position += LSB_BATCH) {
+        size_t count = static_cast<size_t>(std::min<unsigned long long>(LSB_BATCH, end - position));
+
+        positions.inverseBatch(position, count, crumbs);
+        if constexpr (Bits == 2) {
+            kernels.gather(fileData.data(), fileData.size(), crumbs, count, bits);
+            kernels.merge(carrier + (position - offset), bits, count);
+        } else {
+            gather_bits<Bits>(fileData.data(), fileData.size(), crumbs, count, bits);
+            merge_bits<Bits>(carrier + (position - offset), bits, count);
+        }
+    }
+}
 
-		++c;
-            
-		imageData[position] = val;
- 	}
+// Memory order extraction for keyed permutations : carrier bytes
+// are read sequentially and each crumb is OR-ed into its payload byte(s). `data`
+// must be zeroed and hold payloadForPositions(positions.size(), Bits) bytes, padding
+// bits past it are dropped. Windows decoded concurrently can share payload bytes,
+// those set Shared so the OR is atomic.
+template <bool Shared>
+void orPayloadByte(unsigned char& byte, unsigned char value) {
+    if constexpr (Shared) {
+        std::atomic_ref<unsigned char>(byte).fetch_or(value, std::memory_order_relaxed);
+    } else {
+        byte |= value;
+    }
 }
 
-std::vector<unsigned char> decode_file(std::vector<unsigned char>& imageFile, std::vector<int>& positions) {
+template <bool Shared = false, int Bits = LSB_DEFAULT_BITS, typename Positions = KeyedPermutation>
+void decode_lsb_window(const unsigned char* carrier, unsigned long long length, unsigned long long offset,
+                       const Positions& positions, std::vector<unsigned char>& data) {
+    unsigned long long end = std::min(offset + length, positions.size());
+    const LsbKernels& kernels = lsbKernels();
+
+    unsigned long long crumbs[LSB_BATCH];
+    unsigned char bits[LSB_BATCH];
 
-    std::cout << "decoding file ..." << std::endl;
+    for (unsigned long long position = offset; position < end; position += LSB_BATCH) {
+        size_t count = static_cast<size_t>(std::min<unsigned long long>(LSB_BATCH, end - position));
+
+        positions.inverseBatch(position, count, crumbs);
+        if constexpr (Bits == 2) {
+            kernels.extract(carrier + (position - offset), bits, count);
+        } else {
+            extract_bits<Bits>(carrier + (position - offset), bits, count);
+        }
 
-    std::vector<unsigned char> data;
-    unsigned char currentByte = 0x00;
-    int shift = 6; int b = 0; int n = 0; int corrupt = 0;
+        // several crumbs of a batch share a payload byte, the scatter stays scalar
+        for (size_t i = 0; i < count; ++i) {
+            unsigned long long bit = crumbs[i] * Bits;
+            size_t byte = static_cast<size_t>(bit >> 3);
+            unsigned int shift = static_cast<unsigned int>(bit & 7);
+
+            if constexpr (8 % Bits == 0) {
+                if (byte < data.size()) {
+                    orPayloadByte<Shared>(data[byte], static_cast<unsigned char>(bits[i] << (8 - Bits - shift)));
+                }
+            } else {
+                // a crumb crossing a byte boundary lands in two payload bytes
+                unsigned int window = static_cast<unsigned int>(bits[i]) << (16 - Bits - shift);
+                if (byte < data.size()) {
+                    orPayloadByte<Shared>(data[byte], static_cast<unsigned char>(window >> 8));
+                }
+                if ((window & 0xFF) != 0 && byte + 1 < data.size()) {
+                    orPayloadByte<Shared>(data[byte + 1], static_cast<unsigned char>(window));
+                }
+            }
+        }
+    }
+}
 
-    for (auto position : positions) {
+// smallest carrier range handed to one thread
+const unsigned long long LSB_PARALLEL_GRAIN = 64 * LSB_BATCH;
+
+// encode_lsb_window split into carrier ranges across the pool, windows touch
+// disjoint carrier bytes so the result is identical to a single pass
+template <typename Positions>
+void encode_lsb_parallel(unsigned char* carrier, unsigned long long length, unsigned long long offset,
+                         const std::vector<unsigned char>& fileData, const Positions& positions, ThreadPool& pool,
+                         int bits = LSB_DEFAULT_BITS) {
+    unsigned long long end = std::min(offset + length, positions.size());
+    if (end <= offset) {
+        return;
+    }
 
-        unsigned char val = imageFile[position];
-            
-        unsigned char tmp = val;
+    withLsbBits(bits, [&](auto depth) {
+        pool.parallelFor(end - offset, LSB_PARALLEL_GRAIN, [&](unsigned long long first, unsigned long long last) {
+            encode_lsb_window<decltype(depth)::value>(carrier + first, last - first, offset + first, fileData, positions);
+        });
+    });
+}
 
-        currentByte |= ((tmp & 0x03) << shift);
+template <typename Positions>
+void decode_lsb_parallel(const unsigned char* carrier, unsigned long long length, unsigned long long offset,
+                         const Positions& positions, std::vector<unsigned char>& data, ThreadPool& pool,
+                         int bits = LSB_DEFAULT_BITS) {
+    unsigned long long end = std::min(offset + length, positions.size());
+    if (end <= offset) {
+        return;
+    }
 
-        shift -= 2;
-        ++n;
+    withLsbBits(bits, [&](auto depth) {
+        constexpr int Bits = decltype(depth)::value;
 
-        if (shift < 0) {
-            data.push_back(currentByte);
-            currentByte = 0x00;
-            shift = 6;
+        if (pool.size() == 1) {
+            decode_lsb_window<false, Bits>(carrier, end - offset, offset, positions, data);
+            return;
         }
-    }
+
+        pool.parallelFor(end - offset, LSB_PARALLEL_GRAIN, [&](unsigned long long first, unsigned long long last) {
+            decode_lsb_window<true, Bits>(carrier + first, last - first, offset + first, positions, data);
+        });
+    });
+}
+
+// Legacy position tables walked in payload order, split by payload byte : thread ranges
+// start on a 4 crumb boundary so every thread owns its slice of the output
+inline std::vector<unsigned char> decode_file_parallel(const unsigned char* imageFile, const std::vector<int>& positions, ThreadPool& pool) {
+
+    std::vector<unsigned char> data(positions.size() / 4);
+
+    pool.parallelFor(data.size(), LSB_PARALLEL_GRAIN / 4, [&](unsigned long long first, unsigned long long last) {
+        for (unsigned long long i = first; i < last; ++i) {
+            const int* crumb = positions.data() + 4 * i;
+            data[i] = static_cast<unsigned char>(((imageFile[crumb[0]] & 0x03) << 6) | ((imageFile[crumb[1]] & 0x03) << 4) |
+                                                 ((imageFile[crumb[2]] & 0x03) << 2) | (imageFile[crumb[3]] & 0x03));
+        }
+    });
 
     return data;
 }
 
-// O(n) using std::shuffle
-std::vector<int> generateRandomPositions(std::vector<unsigned char> image, unsigned long long seed) {
-    std::vector<int> positions;
+// below this many positions the carrier region stays cache resident and the
+// direct shuffled walk of decode_file_parallel is faster than bucketing
+const unsigned long long LOCALITY_SORT_MIN_POSITIONS = 1ULL << 27;
 
-    if (seed == 0) {
-        std::cerr << "Error:    bad seed" << std::endl;
-        exit(1);
+// Memory order counterpart of decode_file_parallel, same output.
+// (position, crumb) pairs are bucketed by carrier block so each block is read while
+// cache resident, then (crumb, bits) are bucketed by payload block and assembled in
+// a cache resident staging buffer instead of scattering across the whole payload.
+inline std::vector<unsigned char> decode_file_sorted(const unsigned char* imageFile, const std::vector<int>& positions) {
+
+    const int BLOCK_BITS = 16;
+    const unsigned long long BLOCK_MASK = (1ULL << BLOCK_BITS) - 1;
+
+    unsigned long long n = positions.size();
+    unsigned long long numBlocks = (n >> BLOCK_BITS) + 1;
+
+    // positions permute [0, n) : every carrier and payload block holds exactly
+    // 2^BLOCK_BITS entries (bar the last), so bucket ranges are fixed
+    std::vector<unsigned long long> cursor(numBlocks);
+    for (unsigned long long block = 0; block < numBlocks; ++block) {
+        cursor[block] = block << BLOCK_BITS;
     }
 
-    std::cout << "generating randomized embed order from seed ..." << std::endl;
+    // pass 1 : ( crumb << 32 | position ) sorted by carrier block
+    std::vector<unsigned long long> byPosition(n);
+    for (unsigned long long crumb = 0; crumb < n; ++crumb) {
+        unsigned long long position = static_cast<unsigned long long>(positions[crumb]);
+        byPosition[cursor[position >> BLOCK_BITS]++] = (crumb << 32) | position;
+    }
 
-    int numPositions = 0;
+    // pass 2 : read each carrier block, emit ( crumb within payload block << 2 | bits )
+    std::vector<unsigned int> byCrumb(n);
+    for (unsigned long long block = 0; block < numBlocks; ++block) {
+        cursor[block] = block << BLOCK_BITS;
+    }
+    for (auto entry : byPosition) {
+        unsigned long long crumb = entry >> 32;
+        unsigned char bits = imageFile[entry & 0xFFFFFFFFULL] & 0x03;
+        byCrumb[cursor[crumb >> BLOCK_BITS]++] = static_cast<unsigned int>(((crumb & BLOCK_MASK) << 2) | bits);
+    }
+    std::vector<unsigned long long>().swap(byPosition);
+
+    // pass 3 : un-permute each payload block in a staging buffer and pack bytes
+    std::vector<unsigned char> data(n / 4);
+    std::vector<unsigned char> staging(1ULL << BLOCK_BITS);
+    for (unsigned long long block = 0; block < numBlocks; ++block) {
+        unsigned long long first = block << BLOCK_BITS;
+        unsigned long long last = std::min(n, first + (1ULL << BLOCK_BITS));
+
+        for (unsigned long long i = first; i < last; ++i) {
+            staging[byCrumb[i] >> 2] = byCrumb[i] & 0x03;
+        }
+
+        lsbKernels().pack(staging.data(), (last - first) / 4, data.data() + (first >> 2));
+    }
+
+    return data;
+}
+
+// strip the position count packed into the low decimal digits of the seed
+inline unsigned long long splitSeed(unsigned long long seed, int& numPositions) {
+    numPositions = 0;
     int positionsLength = seed % 10;
     seed /= 10;
     for (int i = 0; i < positionsLength; ++i) {
@@ -108,16 +535,201 @@ std::vector<int> generateRandomPositions(std::vector<unsigned char> image, unsig
         seed /= 10;
     }
 
-    std::vector<int> allPositions(numPositions);
+    return seed;
+}
+
+// O(n) using std::shuffle, legacy v1 / v2 containers only. Their decimal
+// packed seeds cannot describe more than 2^31 positions, so int indices suffice.
+inline std::vector<int> generateRandomPositions(unsigned long long seed, unsigned long long count) {
+    int numPositions = static_cast<int>(count);
+
+    // shuffled in place, the table is the only copy
+    std::vector<int> positions(numPositions);
     for (int i = 0; i < numPositions; ++i) {
-        allPositions[i] = i;
+        positions[i] = i;
     }
 
     std::mt19937 gen(static_cast<unsigned long long>(seed));
 
-    std::shuffle(allPositions.begin(), allPositions.end(), gen);
-
-    positions.insert(positions.begin(), allPositions.begin(), allPositions.begin() + numPositions);
+    std::shuffle(positions.begin(), positions.end(), gen);
 
     return positions;
 }
+
+// O(1) memory, positions computed on demand
+inline KeyedPermutation generateKeyedPositions(unsigned long long seed, unsigned long long numPositions) {
+    return KeyedPermutation(seed, numPositions);
+}
+
+inline unsigned long long segmentKey(unsigned long long seed, unsigned long long segment) {
+    return seed + segment * 0xD1B54A32D192ED03ULL;
+}
+
+inline unsigned long long segmentSize(unsigned long long numPositions, unsigned long long segment) {
+    return std::min(SEGMENT_POSITIONS, numPositions - segment * SEGMENT_POSITIONS);
+}
+
+// permutation of segment `segment`, positions relative to the segment start
+inline KeyedPermutation segmentPositions(unsigned long long seed, unsigned long long numPositions, unsigned long long segment) {
+    return KeyedPermutation(segmentKey(seed, segment), segmentSize(numPositions, segment));
+}
+
+inline unsigned long long readLE64(const unsigned char* bytes) {
+    unsigned long long value = 0;
+    for (int i = 0; i < 8; ++i) {
+        value |= static_cast<unsigned long long>(bytes[i]) << (8 * i);
+    }
+    return value;
+}
+
+inline void writeLE64(unsigned long long value, unsigned char* bytes) {
+    for (int i = 0; i < 8; ++i) {
+        bytes[i] = (value >> (8 * i)) & 0xFF;
+    }
+}
+
+// pack / unpack the plaintext seed record stored in the trailer
+inline int packSeedRecord(const SeedRecord& seedRecord, unsigned char* record) {
+    unsigned char flags = seedRecord.authenticated ? SEED_FLAG_MAC : 0;
+    if (seedRecord.compression != PAYLOAD_COMPRESSION_NONE) {
+        record[0] = SEED_FORMAT_V6 | flags;
+        record[1] = seedRecord.positionMode;
+        record[2] = seedRecord.cipherMode;
+        record[3] = seedRecord.bits;
+        record[4] = seedRecord.compression;
+        record[5] = seedRecord.compressionLevel;
+        writeLE64(seedRecord.seed, record + 6);
+        writeLE64(seedRecord.numPositions, record + 14);
+        std::copy(seedRecord.iv, seedRecord.iv + 16, record + 22);
+        writeLE64(seedRecord.plainSize, record + 38);
+
+        return SEED_RECORD_V6_SIZE;
+    }
+
+    // depth 2 keeps the v4 layout, unauthenticated records stay readable by v4 builds
+    if (seedRecord.bits != LSB_DEFAULT_BITS) {
+        record[0] = SEED_FORMAT_V5 | flags;
+        record[1] = seedRecord.positionMode;
+        record[2] = seedRecord.cipherMode;
+        record[3] = seedRecord.bits;
+        writeLE64(seedRecord.seed, record + 4);
+        writeLE64(seedRecord.numPositions, record + 12);
+        std::copy(seedRecord.iv, seedRecord.iv + 16, record + 20);
+
+        return SEED_RECORD_V5_SIZE;
+    }
+
+    record[0] = SEED_FORMAT_V4 | flags;
+    record[1] = seedRecord.positionMode;
+    record[2] = seedRecord.cipherMode;
+    writeLE64(seedRecord.seed, record + 3);
+    writeLE64(seedRecord.numPositions, record + 11);
+    std::copy(seedRecord.iv, seedRecord.iv + 16, record + 19);
+
+    return SEED_RECORD_V4_SIZE;
+}
+
+inline bool unpackSeedRecord(const unsigned char* record, int recordLength, SeedRecord& seedRecord) {
+    unsigned long long& seed = seedRecord.seed;
+    unsigned long long& numPositions = seedRecord.numPositions;
+    unsigned char& mode = seedRecord.positionMode;
+
+    seedRecord.cipherMode = PAYLOAD_CIPHER_CBC;
+    seedRecord.bits = LSB_DEFAULT_BITS;
+    seedRecord.compression = PAYLOAD_COMPRESSION_NONE;
+    seedRecord.compressionLevel = 0;
+    seedRecord.plainSize = 0;
+
+    // v1 records have no version byte to flag
+    seedRecord.authenticated = recordLength >= SEED_RECORD_V4_SIZE && (record[0] & SEED_FLAG_MAC) != 0;
+    unsigned char version = seedRecord.authenticated ? record[0] & ~SEED_FLAG_MAC : record[0];
+
+    if (recordLength == SEED_RECORD_V6_SIZE && version == SEED_FORMAT_V6) {
+        mode = record[1];
+        seedRecord.cipherMode = record[2];
+        seedRecord.bits = record[3];
+        seedRecord.compression = record[4];
+        seedRecord.compressionLevel = record[5];
+        seed = readLE64(record + 6);
+        numPositions = readLE64(record + 14);
+        std::copy(record + 22, record + 38, seedRecord.iv);
+        seedRecord.plainSize = readLE64(record + 38);
+
+        // compression was introduced with segmented mode only
+        if ((seedRecord.compression != PAYLOAD_COMPRESSION_ZLIB && seedRecord.compression != PAYLOAD_COMPRESSION_ZSTD) ||
+            !segmentedPositions(mode)) {
+            std::cerr << "Error:    unknown payload compression" << std::endl;
+            return false;
+        }
+    } else if (recordLength == SEED_RECORD_V5_SIZE && version == SEED_FORMAT_V5) {
+        mode = record[1];
+        seedRecord.cipherMode = record[2];
+        seedRecord.bits = record[3];
+        seed = readLE64(record + 4);
+        numPositions = readLE64(record + 12);
+        std::copy(record + 20, record + 36, seedRecord.iv);
+    } else if (recordLength == SEED_RECORD_V4_SIZE && version == SEED_FORMAT_V4) {
+        mode = record[1];
+        seedRecord.cipherMode = record[2];
+        seed = readLE64(record + 3);
+        numPositions = readLE64(record + 11);
+        std::copy(record + 19, record + 35, seedRecord.iv);
+    } else if (recordLength == SEED_RECORD_V3_SIZE && record[0] == SEED_FORMAT_V3) {
+        mode = record[1];
+        seed = readLE64(record + 2);
+        numPositions = readLE64(record + 10);
+    } else if (recordLength == SEED_RECORD_V1_SIZE || (recordLength == SEED_RECORD_V2_SIZE && record[0] == SEED_FORMAT_V2)) {
+        mode = recordLength == SEED_RECORD_V1_SIZE ? POSITIONS_LEGACY_SHUFFLE : record[1];
+        seed = readLE64(recordLength == SEED_RECORD_V1_SIZE ? record : record + 2);
+
+        if (seed == 0) {
+            std::cerr << "Error:    bad seed" << std::endl;
+            return false;
+        }
+
+        int count = 0;
+        seed = splitSeed(seed, count);
+        numPositions = static_cast<unsigned long long>(count);
+    } else {
+        std::cerr << "Error:    unknown seed format" << std::endl;
+        return false;
+    }
+
+    if (mode != POSITIONS_LEGACY_SHUFFLE && mode != POSITIONS_KEYED_PERMUTATION && !segmentedPositions(mode)) {
+        std::cerr << "Error:    unknown position mode" << std::endl;
+        return false;
+    }
+
+    // other depths were introduced with segmented mode only
+    if (seedRecord.bits < LSB_MIN_BITS || seedRecord.bits > LSB_MAX_BITS ||
+        (seedRecord.bits != LSB_DEFAULT_BITS && !segmentedPositions(mode))) {
+        std::cerr << "Error:    unsupported LSB depth" << std::endl;
+        return false;
+    }
+
+    // segments are decrypted independently, only CTR allows that. The position
+    // count must be the one written for a whole number of payload bytes.
+    if (segmentedPositions(mode) && (seedRecord.cipherMode != PAYLOAD_CIPHER_CTR ||
+        positionsForPayload(payloadForPositions(numPositions, seedRecord.bits), seedRecord.bits) != numPositions)) {
+        std::cerr << "Error:    bad seed" << std::endl;
+        return false;
+    }
+
+    // payload MACs were introduced with segmented mode only
+    if (seedRecord.authenticated && !segmentedPositions(mode)) {
+        std::cerr << "Error:    bad seed" << std::endl;
+        return false;
+    }
+
+    if (seedRecord.cipherMode != PAYLOAD_CIPHER_CBC && seedRecord.cipherMode != PAYLOAD_CIPHER_CTR) {
+        std::cerr << "Error:    unknown payload cipher" << std::endl;
+        return false;
+    }
+
+    if (numPositions == 0) {
+        std::cerr << "Error:    bad seed" << std::endl;
+        return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,522 @@
+#include <cstring>
+#include <string>
+#include <algorithm>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+    #define RSTEG_X86_SIMD 1
+    #include <immintrin.h>
+#endif
+
+// LSB kernels with runtime CPU dispatch. Every vector variant is bit-identical to
+// the scalar one, which also handles the tail of each batch.
+//  inverse : crumb index of `count` consecutive carrier positions (Feistel decipher + cycle walk)
+//  gather  : 2-bit crumbs of the payload at arbitrary crumb indices
+//  merge   : carrier = (carrier & 0xFC) | crumb
+//  extract : crumb = carrier & 0x03
+//  pack    : 4 crumbs -> 1 payload byte, most significant crumb first
+
+const int SIMD_SCALAR = 0;
+const int SIMD_SSE41 = 1;
+const int SIMD_AVX2 = 2;
+const int SIMD_AVX512 = 3;
+
+const int FEISTEL_ROUNDS = 6;
+
+struct FeistelParams {
+    const unsigned long long* roundKeys;
+    int halfBits;
+    unsigned long long halfMask;
+    unsigned long long n;
+};
+
+// splitmix64 finalizer
+inline unsigned long long feistelMix(unsigned long long z) {
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+inline unsigned long long feistelDecipher(const FeistelParams& f, unsigned long long x) {
+    unsigned long long left = x >> f.halfBits;
+    unsigned long long right = x & f.halfMask;
+    for (int r = FEISTEL_ROUNDS - 1; r >= 0; --r) {
+        unsigned long long tmp = left;
+        left = right ^ (feistelMix(left ^ f.roundKeys[r]) & f.halfMask);
+        right = tmp;
+    }
+    return (left << f.halfBits) | right;
+}
+
+inline unsigned long long feistelInverse(const FeistelParams& f, unsigned long long position) {
+    do {
+        position = feistelDecipher(f, position);
+    } while (position >= f.n);
+    return position;
+}
+
+inline unsigned char crumbAt(const unsigned char* payload, unsigned long long crumb) {
+    return (payload[crumb >> 2] >> (6 - 2 * (crumb & 0x03))) & 0x03;
+}
+
+// scalar kernels
+
+inline void inverse_scalar(const FeistelParams& f, unsigned long long first, size_t count, unsigned long long* out) {
+    for (size_t i = 0; i < count; ++i) {
+        out[i] = feistelInverse(f, first + i);
+    }
+}
+
+inline void gather_scalar(const unsigned char* payload, size_t payloadSize, const unsigned long long* crumbs, size_t count, unsigned char* out) {
+    (void)payloadSize;
+    for (size_t i = 0; i < count; ++i) {
+        out[i] = crumbAt(payload, crumbs[i]);
+    }
+}
+
+inline void merge_scalar(unsigned char* carrier, const unsigned char* crumbs, size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+        carrier[i] = (carrier[i] & 0xFC) | crumbs[i];
+    }
+}
+
+inline void extract_scalar(const unsigned char* carrier, unsigned char* crumbs, size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+        crumbs[i] = carrier[i] & 0x03;
+    }
+}
+
+inline void pack_scalar(const unsigned char* crumbs, size_t numBytes, unsigned char* out) {
+    for (size_t i = 0; i < numBytes; ++i) {
+        const unsigned char* c = crumbs + 4 * i;
+        out[i] = static_cast<unsigned char>((c[0] << 6) | (c[1] << 4) | (c[2] << 2) | c[3]);
+    }
+}
+
+// depth specialized kernels, `Bits` carrier LSBs per position ( 1 - 4 ). Crumb k is
+// bits [ k * Bits, k * Bits + Bits ) of the payload read most significant bit first,
+// so 3 bit crumbs may straddle two payload bytes. Depth 2 keeps the dispatched kernels.
+
+template <int Bits>
+inline unsigned char crumbAtBits(const unsigned char* payload, size_t payloadSize, unsigned long long crumb) {
+    constexpr unsigned int mask = (1u << Bits) - 1;
+    unsigned long long bit = crumb * Bits;
+    size_t byte = static_cast<size_t>(bit >> 3);
+    unsigned int offset = static_cast<unsigned int>(bit & 7);
+
+    if constexpr (8 % Bits == 0) {
+        (void)payloadSize;
+        return static_cast<unsigned char>((payload[byte] >> (8 - Bits - offset)) & mask);
+    } else {
+        unsigned int window = (payload[byte] << 8) | (byte + 1 < payloadSize ? payload[byte + 1] : 0);
+        return static_cast<unsigned char>((window >> (16 - Bits - offset)) & mask);
+    }
+}
+
+template <int Bits>
+void gather_bits(const unsigned char* payload, size_t payloadSize, const unsigned long long* crumbs, size_t count, unsigned char* out) {
+    for (size_t i = 0; i < count; ++i) {
+        out[i] = crumbAtBits<Bits>(payload, payloadSize, crumbs[i]);
+    }
+}
+
+template <int Bits>
+void merge_bits(unsigned char* carrier, const unsigned char* crumbs, size_t count) {
+    constexpr unsigned char keep = static_cast<unsigned char>(~((1u << Bits) - 1));
+    for (size_t i = 0; i < count; ++i) {
+        carrier[i] = (carrier[i] & keep) | crumbs[i];
+    }
+}
+
+template <int Bits>
+void extract_bits(const unsigned char* carrier, unsigned char* crumbs, size_t count) {
+    constexpr unsigned char mask = static_cast<unsigned char>((1u << Bits) - 1);
+    for (size_t i = 0; i < count; ++i) {
+        crumbs[i] = carrier[i] & mask;
+    }
+}
+
+#ifdef RSTEG_X86_SIMD
+
+// SSE4.1
+
+__attribute__((target("sse4.1")))
+inline void merge_sse41(unsigned char* carrier, const unsigned char* crumbs, size_t count) {
+    const __m128i high = _mm_set1_epi8(static_cast<char>(0xFC));
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(carrier + i));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(crumbs + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(carrier + i), _mm_or_si128(_mm_and_si128(c, high), b));
+    }
+    merge_scalar(carrier + i, crumbs + i, count - i);
+}
+
+__attribute__((target("sse4.1")))
+inline void extract_sse41(const unsigned char* carrier, unsigned char* crumbs, size_t count) {
+    const __m128i low = _mm_set1_epi8(0x03);
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(carrier + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(crumbs + i), _mm_and_si128(c, low));
+    }
+    extract_scalar(carrier + i, crumbs + i, count - i);
+}
+
+// crumbs ( c0 c1 c2 c3 ) -> c0 * 64 + c1 * 16 + c2 * 4 + c3 in each 32-bit lane
+__attribute__((target("sse4.1")))
+inline void pack_sse41(const unsigned char* crumbs, size_t numBytes, unsigned char* out) {
+    const __m128i weights = _mm_set1_epi32(0x01041040);
+    const __m128i ones = _mm_set1_epi16(1);
+    const __m128i lowBytes = _mm_setr_epi8(0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+    size_t i = 0;
+    for (; i + 4 <= numBytes; i += 4) {
+        __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(crumbs + 4 * i));
+        __m128i sums = _mm_madd_epi16(_mm_maddubs_epi16(c, weights), ones);
+        int packed = _mm_cvtsi128_si32(_mm_shuffle_epi8(sums, lowBytes));
+        memcpy(out + i, &packed, 4);
+    }
+    pack_scalar(crumbs + 4 * i, numBytes - i, out + i);
+}
+
+// AVX2
+
+__attribute__((target("avx2")))
+inline __m256i mullo64_avx2(__m256i a, __m256i b) {
+    __m256i lo = _mm256_mul_epu32(a, b);
+    __m256i cross = _mm256_add_epi64(_mm256_mul_epu32(_mm256_srli_epi64(a, 32), b),
+                                     _mm256_mul_epu32(a, _mm256_srli_epi64(b, 32)));
+    return _mm256_add_epi64(lo, _mm256_slli_epi64(cross, 32));
+}
+
+__attribute__((target("avx2")))
+inline __m256i mix_avx2(__m256i z) {
+    z = mullo64_avx2(_mm256_xor_si256(z, _mm256_srli_epi64(z, 30)), _mm256_set1_epi64x(0xBF58476D1CE4E5B9ULL));
+    z = mullo64_avx2(_mm256_xor_si256(z, _mm256_srli_epi64(z, 27)), _mm256_set1_epi64x(0x94D049BB133111EBULL));
+    return _mm256_xor_si256(z, _mm256_srli_epi64(z, 31));
+}
+
+__attribute__((target("avx2")))
+inline __m256i decipher_avx2(const FeistelParams& f, __m256i x) {
+    const __m128i shift = _mm_cvtsi32_si128(f.halfBits);
+    const __m256i mask = _mm256_set1_epi64x(f.halfMask);
+    __m256i left = _mm256_srl_epi64(x, shift);
+    __m256i right = _mm256_and_si256(x, mask);
+    for (int r = FEISTEL_ROUNDS - 1; r >= 0; --r) {
+        __m256i key = _mm256_set1_epi64x(f.roundKeys[r]);
+        __m256i tmp = left;
+        left = _mm256_xor_si256(right, _mm256_and_si256(mix_avx2(_mm256_xor_si256(left, key)), mask));
+        right = tmp;
+    }
+    return _mm256_or_si256(_mm256_sll_epi64(left, shift), right);
+}
+
+// positions stay below 2^62, signed 64-bit compares are exact
+__attribute__((target("avx2")))
+inline void inverse_avx2(const FeistelParams& f, unsigned long long first, size_t count, unsigned long long* out) {
+    const __m256i last = _mm256_set1_epi64x(f.n - 1);
+    const __m256i lanes = _mm256_setr_epi64x(0, 1, 2, 3);
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m256i x = _mm256_add_epi64(_mm256_set1_epi64x(first + i), lanes);
+        __m256i pending = _mm256_set1_epi64x(-1);
+        do {
+            x = _mm256_blendv_epi8(x, decipher_avx2(f, x), pending);
+            pending = _mm256_and_si256(pending, _mm256_cmpgt_epi64(x, last));
+        } while (!_mm256_testz_si256(pending, pending));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), x);
+    }
+    inverse_scalar(f, first + i, count - i, out + i);
+}
+
+// dword gathers at byte offsets, groups reaching the last 3 payload bytes fall back to scalar
+__attribute__((target("avx2")))
+inline void gather_avx2(const unsigned char* payload, size_t payloadSize, const unsigned long long* crumbs, size_t count, unsigned char* out) {
+    const __m256i limit = _mm256_set1_epi64x(static_cast<long long>(payloadSize) - 4);
+    const __m256i narrow = _mm256_setr_epi32(0, 2, 4, 6, 0, 2, 4, 6);
+    const __m128i lowBytes = _mm_setr_epi8(0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+    size_t i = 0;
+    for (; i + 4 <= count && payloadSize >= 4; i += 4) {
+        __m256i idx = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(crumbs + i));
+        __m256i offsets = _mm256_srli_epi64(idx, 2);
+        if (!_mm256_testz_si256(_mm256_cmpgt_epi64(offsets, limit), _mm256_set1_epi64x(-1))) {
+            gather_scalar(payload, payloadSize, crumbs + i, 4, out + i);
+            continue;
+        }
+
+        __m128i words = _mm256_i64gather_epi32(reinterpret_cast<const int*>(payload), offsets, 1);
+        __m128i low = _mm256_castsi256_si128(_mm256_permutevar8x32_epi32(idx, narrow));
+        __m128i shifts = _mm_sub_epi32(_mm_set1_epi32(6), _mm_slli_epi32(_mm_and_si128(low, _mm_set1_epi32(3)), 1));
+        __m128i bits = _mm_and_si128(_mm_srlv_epi32(words, shifts), _mm_set1_epi32(3));
+        int packed = _mm_cvtsi128_si32(_mm_shuffle_epi8(bits, lowBytes));
+        memcpy(out + i, &packed, 4);
+    }
+    gather_scalar(payload, payloadSize, crumbs + i, count - i, out + i);
+}
+
+__attribute__((target("avx2")))
+inline void merge_avx2(unsigned char* carrier, const unsigned char* crumbs, size_t count) {
+    const __m256i high = _mm256_set1_epi8(static_cast<char>(0xFC));
+    size_t i = 0;
+    for (; i + 32 <= count; i += 32) {
+        __m256i c = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(carrier + i));
+        __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(crumbs + i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(carrier + i), _mm256_or_si256(_mm256_and_si256(c, high), b));
+    }
+    merge_sse41(carrier + i, crumbs + i, count - i);
+}
+
+__attribute__((target("avx2")))
+inline void extract_avx2(const unsigned char* carrier, unsigned char* crumbs, size_t count) {
+    const __m256i low = _mm256_set1_epi8(0x03);
+    size_t i = 0;
+    for (; i + 32 <= count; i += 32) {
+        __m256i c = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(carrier + i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(crumbs + i), _mm256_and_si256(c, low));
+    }
+    extract_sse41(carrier + i, crumbs + i, count - i);
+}
+
+__attribute__((target("avx2")))
+inline void pack_avx2(const unsigned char* crumbs, size_t numBytes, unsigned char* out) {
+    const __m256i weights = _mm256_set1_epi32(0x01041040);
+    const __m256i ones = _mm256_set1_epi16(1);
+    const __m256i lowBytes = _mm256_setr_epi8(0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+                                              0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+    size_t i = 0;
+    for (; i + 8 <= numBytes; i += 8) {
+        __m256i c = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(crumbs + 4 * i));
+        __m256i sums = _mm256_madd_epi16(_mm256_maddubs_epi16(c, weights), ones);
+        __m256i packed = _mm256_shuffle_epi8(sums, lowBytes);
+        int lo = _mm256_extract_epi32(packed, 0);
+        int hi = _mm256_extract_epi32(packed, 4);
+        memcpy(out + i, &lo, 4);
+        memcpy(out + i + 4, &hi, 4);
+    }
+    pack_sse41(crumbs + 4 * i, numBytes - i, out + i);
+}
+
+// AVX-512 ( F + DQ + BW + VL )
+
+#define RSTEG_AVX512 __attribute__((target("avx512f,avx512dq,avx512bw,avx512vl")))
+
+RSTEG_AVX512
+inline __m512i mix_avx512(__m512i z) {
+    z = _mm512_mullo_epi64(_mm512_xor_si512(z, _mm512_srli_epi64(z, 30)), _mm512_set1_epi64(0xBF58476D1CE4E5B9ULL));
+    z = _mm512_mullo_epi64(_mm512_xor_si512(z, _mm512_srli_epi64(z, 27)), _mm512_set1_epi64(0x94D049BB133111EBULL));
+    return _mm512_xor_si512(z, _mm512_srli_epi64(z, 31));
+}
+
+RSTEG_AVX512
+inline __m512i decipher_avx512(const FeistelParams& f, __m512i x) {
+    const __m128i shift = _mm_cvtsi32_si128(f.halfBits);
+    const __m512i mask = _mm512_set1_epi64(f.halfMask);
+    __m512i left = _mm512_srl_epi64(x, shift);
+    __m512i right = _mm512_and_si512(x, mask);
+    for (int r = FEISTEL_ROUNDS - 1; r >= 0; --r) {
+        __m512i key = _mm512_set1_epi64(f.roundKeys[r]);
+        __m512i tmp = left;
+        left = _mm512_xor_si512(right, _mm512_and_si512(mix_avx512(_mm512_xor_si512(left, key)), mask));
+        right = tmp;
+    }
+    return _mm512_or_si512(_mm512_sll_epi64(left, shift), right);
+}
+
+// Cycle walking takes a data dependent number of rounds per position, so lanes
+// that land inside [0, n) scatter their result and are refilled with the next
+// position instead of idling until the slowest lane of the vector finishes.
+// Several independent vectors are in flight to hide the multiply latency.
+RSTEG_AVX512
+inline void inverse_avx512(const FeistelParams& f, unsigned long long first, size_t count, unsigned long long* out) {
+    const int STREAMS = 4;
+
+    if (count < 8 * STREAMS) {
+        inverse_avx2(f, first, count, out);
+        return;
+    }
+
+    const __m512i n = _mm512_set1_epi64(f.n);
+    const __m512i lanes = _mm512_setr_epi64(0, 1, 2, 3, 4, 5, 6, 7);
+
+    __m512i index[STREAMS];
+    __m512i x[STREAMS];
+    __mmask8 active[STREAMS];
+    size_t next = 0;
+
+    for (int s = 0; s < STREAMS; ++s, next += 8) {
+        index[s] = _mm512_add_epi64(_mm512_set1_epi64(next), lanes);
+        x[s] = _mm512_add_epi64(_mm512_set1_epi64(first), index[s]);
+        active[s] = 0xFF;
+    }
+
+    while (active[0] | active[1] | active[2] | active[3]) {
+        for (int s = 0; s < STREAMS; ++s) {
+            x[s] = _mm512_mask_mov_epi64(x[s], active[s], decipher_avx512(f, x[s]));
+        }
+
+        for (int s = 0; s < STREAMS; ++s) {
+            __mmask8 done = _mm512_mask_cmplt_epu64_mask(active[s], x[s], n);
+            if (!done) {
+                continue;
+            }
+            _mm512_mask_i64scatter_epi64(out, done, index[s], x[s], 8);
+
+            // hand the lowest finished lanes the next positions
+            size_t take = std::min<size_t>(__builtin_popcount(done), count - next);
+            unsigned int free = done;
+            __mmask8 refill = 0;
+            for (size_t t = 0; t < take; ++t) {
+                refill |= free & (0u - free);
+                free &= free - 1;
+            }
+
+            __m512i fresh = _mm512_add_epi64(_mm512_set1_epi64(next), lanes);
+            index[s] = _mm512_mask_expand_epi64(index[s], refill, fresh);
+            x[s] = _mm512_mask_expand_epi64(x[s], refill, _mm512_add_epi64(fresh, _mm512_set1_epi64(first)));
+
+            next += take;
+            active[s] = (active[s] & ~done) | refill;
+        }
+    }
+}
+
+RSTEG_AVX512
+inline void gather_avx512(const unsigned char* payload, size_t payloadSize, const unsigned long long* crumbs, size_t count, unsigned char* out) {
+    const __m512i limit = _mm512_set1_epi64(static_cast<long long>(payloadSize) - 4);
+    size_t i = 0;
+    for (; i + 8 <= count && payloadSize >= 4; i += 8) {
+        __m512i idx = _mm512_loadu_si512(crumbs + i);
+        __m512i offsets = _mm512_srli_epi64(idx, 2);
+        if (_mm512_cmpgt_epi64_mask(offsets, limit)) {
+            gather_scalar(payload, payloadSize, crumbs + i, 8, out + i);
+            continue;
+        }
+
+        __m256i words = _mm512_i64gather_epi32(offsets, payload, 1);
+        __m256i low = _mm512_cvtepi64_epi32(idx);
+        __m256i shifts = _mm256_sub_epi32(_mm256_set1_epi32(6), _mm256_slli_epi32(_mm256_and_si256(low, _mm256_set1_epi32(3)), 1));
+        __m256i bits = _mm256_and_si256(_mm256_srlv_epi32(words, shifts), _mm256_set1_epi32(3));
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(out + i), _mm256_cvtepi32_epi8(bits));
+    }
+    gather_avx2(payload, payloadSize, crumbs + i, count - i, out + i);
+}
+
+RSTEG_AVX512
+inline void merge_avx512(unsigned char* carrier, const unsigned char* crumbs, size_t count) {
+    const __m512i low = _mm512_set1_epi8(0x03);
+    size_t i = 0;
+    for (; i + 64 <= count; i += 64) {
+        __m512i c = _mm512_loadu_si512(carrier + i);
+        __m512i b = _mm512_loadu_si512(crumbs + i);
+        // bitwise select low ? b : c
+        __m512i merged = _mm512_ternarylogic_epi64(low, b, c, 0xCA);
+        _mm512_storeu_si512(carrier + i, merged);
+    }
+    merge_avx2(carrier + i, crumbs + i, count - i);
+}
+
+RSTEG_AVX512
+inline void extract_avx512(const unsigned char* carrier, unsigned char* crumbs, size_t count) {
+    const __m512i low = _mm512_set1_epi8(0x03);
+    size_t i = 0;
+    for (; i + 64 <= count; i += 64) {
+        _mm512_storeu_si512(crumbs + i, _mm512_and_si512(_mm512_loadu_si512(carrier + i), low));
+    }
+    extract_avx2(carrier + i, crumbs + i, count - i);
+}
+
+RSTEG_AVX512
+inline void pack_avx512(const unsigned char* crumbs, size_t numBytes, unsigned char* out) {
+    const __m512i weights = _mm512_set1_epi32(0x01041040);
+    const __m512i ones = _mm512_set1_epi16(1);
+    size_t i = 0;
+    for (; i + 16 <= numBytes; i += 16) {
+        __m512i c = _mm512_loadu_si512(crumbs + 4 * i);
+        __m512i sums = _mm512_madd_epi16(_mm512_maddubs_epi16(c, weights), ones);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm512_cvtepi32_epi8(sums));
+    }
+    pack_avx2(crumbs + 4 * i, numBytes - i, out + i);
+}
+
+#endif
+
+struct LsbKernels {
+    void (*inverse)(const FeistelParams&, unsigned long long, size_t, unsigned long long*);
+    void (*gather)(const unsigned char*, size_t, const unsigned long long*, size_t, unsigned char*);
+    void (*merge)(unsigned char*, const unsigned char*, size_t);
+    void (*extract)(const unsigned char*, unsigned char*, size_t);
+    void (*pack)(const unsigned char*, size_t, unsigned char*);
+};
+
+inline int detectSimdLevel() {
+#ifdef RSTEG_X86_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512dq") &&
+        __builtin_cpu_supports("avx512bw") && __builtin_cpu_supports("avx512vl")) {
+        return SIMD_AVX512;
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        return SIMD_AVX2;
+    }
+    if (__builtin_cpu_supports("sse4.1")) {
+        return SIMD_SSE41;
+    }
+#endif
+    return SIMD_SCALAR;
+}
+
+inline LsbKernels selectKernels(int level) {
+    LsbKernels k = {inverse_scalar, gather_scalar, merge_scalar, extract_scalar, pack_scalar};
+#ifdef RSTEG_X86_SIMD
+    if (level >= SIMD_SSE41) {
+        k.merge = merge_sse41;
+        k.extract = extract_sse41;
+        k.pack = pack_sse41;
+    }
+    if (level >= SIMD_AVX2) {
+        k = {inverse_avx2, gather_avx2, merge_avx2, extract_avx2, pack_avx2};
+    }
+    if (level >= SIMD_AVX512) {
+        k = {inverse_avx512, gather_avx512, merge_avx512, extract_avx512, pack_avx512};
+    }
+#else
+    (void)level;
+#endif
+    return k;
+}
+
+inline int& simdLevel() {
+    static int level = detectSimdLevel();
+    return level;
+}
+
+inline LsbKernels& activeKernels() {
+    static LsbKernels kernels = selectKernels(simdLevel());
+    return kernels;
+}
+
+inline const LsbKernels& lsbKernels() {
+    return activeKernels();
+}
+
+// force a lower level ( "scalar" "sse4.1" "avx2" "avx512" "auto" ), never above what the CPU supports
+inline bool setSimdLevel(const std::string& name) {
+    int detected = detectSimdLevel();
+    int level = detected;
+
+    if (name == "scalar") {
+        level = SIMD_SCALAR;
+    } else if (name == "sse4.1") {
+        level = SIMD_SSE41;
+    } else if (name == "avx2") {
+        level = SIMD_AVX2;
+    } else if (name == "avx512") {
+        level = SIMD_AVX512;
+    } else if (name != "auto") {
+        return false;
+    }
+
+    simdLevel() = std::min(level, detected);
+    activeKernels() = selectKernels(simdLevel());
+
+    return true;
+}
@@ -0,0 +1,179 @@
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <functional>
+
+// Peak memory planning for --max-memory. A job's resident buffers are estimated
+// from the container geometry and the seed record before anything large is
+// allocated. Over budget, cheaper variants are picked one at a time : the
+// sequential PNG writer, the unsorted legacy extraction, a single frame video
+// pipeline, the decoded container spilled to a mapped temporary file and finally
+// no payload compression. A job that still does not fit fails with its estimate.
+// Mapped embed files and written outputs are page cache the kernel reclaims on
+// its own and are not counted. Include after io_helpers.hpp and lsb_rand.hpp.
+
+// process, OpenSSL, codec and worker overhead next to the buffers below
+const unsigned long long MEMORY_RUNTIME_BYTES = 16ULL << 20;
+// zlib / zstd contexts and the inflater chunk
+const unsigned long long MEMORY_CODEC_BYTES = 16ULL << 20;
+// frames OpenCV holds on top of the pipeline : one in the decoder, one in the encoder
+const int MEMORY_CODEC_FRAMES = 2;
+
+// what the planner knows about a job before it runs
+struct MemoryJob {
+    bool embed = true;
+    bool video = false;
+    unsigned long long frameBytes = 0;          // one decoded video frame
+    unsigned long long pixelBytes = 0;          // decoded PNG
+    int height = 0;                             // PNG rows, for the writer
+    unsigned long long numPositions = 0;        // an upper bound on embed
+    unsigned char positionMode = POSITIONS_SEGMENTED_PERMUTATION;
+    unsigned char cipherMode = PAYLOAD_CIPHER_CTR;
+    int bits = 2;
+    unsigned long long compressBytes = 0;       // embed file to compress, 0 : none
+    bool inflate = false;                       // compressed payload on extract
+};
+
+struct MemoryPlan {
+    unsigned long long budget = 0;              // bytes, 0 : unlimited
+    bool bandedPng = true;                      // parallel PNG writer, keeps a filtered copy and the bands
+    bool sortedLegacy = true;                   // locality sorted legacy extraction, 12 more bytes per position
+    int videoFrames = VIDEO_PIPELINE_FRAMES;
+    bool spillContainer = false;                // decoded PNG or legacy video prefix in a spill file
+    bool compress = true;                       // the compressed payload is held in memory
+    std::vector<std::pair<std::string, unsigned long long>> items;
+
+    unsigned long long estimate() const {
+        unsigned long long total = 0;
+        for (const auto& item : items) {
+            total += item.second;
+        }
+        return total;
+    }
+};
+
+// resident bytes of `job` under the variants picked in `plan`, buffer by buffer
+inline void estimateMemory(const MemoryJob& job, MemoryPlan& plan) {
+    plan.items.clear();
+    plan.items.emplace_back("runtime", MEMORY_RUNTIME_BYTES);
+
+    unsigned long long n = job.numPositions;
+    if (segmentedPositions(job.positionMode)) {
+        unsigned long long segment = std::min(SEGMENT_POSITIONS, n);
+        plan.items.emplace_back("segment", payloadForPositions(segment, job.bits));
+        if (job.positionMode == POSITIONS_SEGMENTED_SHUFFLE) {
+            unsigned long long blocks = (segment + SHUFFLE_CHUNK_POSITIONS - 1) / SHUFFLE_CHUNK_POSITIONS;
+            plan.items.emplace_back("shuffle table", segment * sizeof(uint32_t) + blocks * blocks * sizeof(uint32_t));
+        }
+    } else {
+        plan.items.emplace_back("extracted payload", n / 4 * (job.cipherMode == PAYLOAD_CIPHER_CTR ? 1 : 2));
+        if (job.positionMode == POSITIONS_LEGACY_SHUFFLE) {
+            plan.items.emplace_back("position table", n * sizeof(int));
+            if (plan.sortedLegacy && n >= LOCALITY_SORT_MIN_POSITIONS) {
+                plan.items.emplace_back("locality sort", n * (sizeof(unsigned long long) + sizeof(unsigned int)));
+            }
+        }
+    }
+
+    if (job.video) {
+        plan.items.emplace_back("video frames", static_cast<unsigned long long>(plan.videoFrames + MEMORY_CODEC_FRAMES) * job.frameBytes);
+        // unsegmented records are extracted from the whole decoded prefix
+        if (!job.embed && !segmentedPositions(job.positionMode) && !plan.spillContainer) {
+            plan.items.emplace_back("container prefix", n);
+        }
+    } else {
+        if (!plan.spillContainer) {
+            plan.items.emplace_back("container pixels", job.pixelBytes);
+        }
+        if (job.embed && plan.bandedPng) {
+            unsigned long long filtered = job.pixelBytes + static_cast<unsigned long long>(job.height);
+            plan.items.emplace_back("PNG bands", 2 * filtered);
+        }
+    }
+
+    if (job.embed && plan.compress && job.compressBytes > 0) {
+        plan.items.emplace_back("compression", 2 * job.compressBytes + MEMORY_CODEC_BYTES);
+    }
+    if (job.inflate) {
+        plan.items.emplace_back("decompression", MEMORY_CODEC_BYTES);
+    }
+}
+
+inline void printMemory(std::ostream& out, unsigned long long bytes) {
+    out << std::fixed << std::setprecision(1) << static_cast<double>(bytes) / (1024.0 * 1024.0) << " MiB";
+}
+
+// Fits `job` into plan.budget : variants are picked cheapest first until the
+// estimate fits, then those made unnecessary by later picks are given back. False,
+// with the estimate of the leanest plan on stderr, if even that does not fit.
+inline bool planMemory(const MemoryJob& job, MemoryPlan& plan, std::ostream& progress) {
+    struct Variant {
+        bool applies;
+        const char* name;
+        std::function<void(bool)> pick;
+        bool picked;
+    };
+
+    bool legacy = job.positionMode == POSITIONS_LEGACY_SHUFFLE && job.numPositions >= LOCALITY_SORT_MIN_POSITIONS;
+    bool spillable = !job.video || (!job.embed && !segmentedPositions(job.positionMode));
+    std::vector<Variant> variants = {
+        {job.embed && !job.video, "sequential PNG writer", [&](bool on) { plan.bandedPng = !on; }, false},
+        {!job.embed && legacy, "unsorted legacy extraction", [&](bool on) { plan.sortedLegacy = !on; }, false},
+        {job.video, "single frame video pipeline", [&](bool on) { plan.videoFrames = on ? 1 : VIDEO_PIPELINE_FRAMES; }, false},
+        {spillable, "container spilled to disk", [&](bool on) { plan.spillContainer = on; }, false},
+        {job.embed && job.compressBytes > 0, "payload stored uncompressed", [&](bool on) { plan.compress = !on; }, false},
+    };
+
+    auto fits = [&] {
+        estimateMemory(job, plan);
+        return plan.budget == 0 || plan.estimate() <= plan.budget;
+    };
+
+    for (Variant& variant : variants) {
+        if (fits()) {
+            break;
+        }
+        if (variant.applies) {
+            variant.pick(true);
+            variant.picked = true;
+        }
+    }
+    for (auto variant = variants.rbegin(); variant != variants.rend(); ++variant) {
+        if (variant->picked) {
+            variant->pick(false);
+            variant->picked = !fits();
+            variant->pick(variant->picked);
+        }
+    }
+
+    if (!fits()) {
+        std::cerr << "Error:    job needs about ";
+        printMemory(std::cerr, plan.estimate());
+        std::cerr << ", over the ";
+        printMemory(std::cerr, plan.budget);
+        std::cerr << " memory budget ( ";
+        for (size_t i = 0; i < plan.items.size(); ++i) {
+            std::cerr << (i == 0 ? "" : ", ") << plan.items[i].first << " ";
+            printMemory(std::cerr, plan.items[i].second);
+        }
+        std::cerr << " )" << std::endl;
+        return false;
+    }
+
+    progress << "memory plan:      ";
+    printMemory(progress, plan.estimate());
+    progress << " of ";
+    printMemory(progress, plan.budget);
+    const char* separator = ", ";
+    for (const Variant& variant : variants) {
+        if (variant.picked) {
+            progress << separator << variant.name;
+            separator = " + ";
+        }
+    }
+    progress << std::endl;
+
+    return true;
+}
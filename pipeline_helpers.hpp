@@ -0,0 +1,253 @@
+#include <functional>
+#include <openssl/hmac.h>
+#include <openssl/crypto.h>
+#include "stats_helpers.hpp"
+
+// Bounded memory embed / extract for the segmented position modes. Carrier
+// windows are fed in container order; the payload is read, encrypted and embedded
+// (or extracted, decrypted and written) one segment at a time, so peak memory is
+// one segment ( plus its position table in shuffle mode ) and whatever carrier
+// window the caller holds.
+
+// The current segment's positions, a keyed permutation evaluated on demand or a
+// shuffled table. fn( positions ) is instantiated for both.
+class SegmentPositions {
+public:
+    explicit SegmentPositions(const SeedRecord& seedRecord) : seedRecord(seedRecord), keyed(0, 1) {}
+
+    void load(unsigned long long segment, ThreadPool& pool) {
+        StageTimer timer(STAGE_POSITIONS, segmentSize(seedRecord.numPositions, segment));
+        if (seedRecord.positionMode == POSITIONS_SEGMENTED_SHUFFLE) {
+            shuffled.build(segmentKey(seedRecord.seed, segment), segmentSize(seedRecord.numPositions, segment), pool);
+        } else {
+            keyed = segmentPositions(seedRecord.seed, seedRecord.numPositions, segment);
+        }
+    }
+
+    unsigned long long size() const {
+        return seedRecord.positionMode == POSITIONS_SEGMENTED_SHUFFLE ? shuffled.size() : keyed.size();
+    }
+
+    template <typename Fn>
+    void visit(Fn&& fn) const {
+        if (seedRecord.positionMode == POSITIONS_SEGMENTED_SHUFFLE) {
+            fn(shuffled);
+        } else {
+            fn(keyed);
+        }
+    }
+
+private:
+    const SeedRecord& seedRecord;
+    KeyedPermutation keyed;
+    ShuffledPermutation shuffled;
+};
+
+const size_t PAYLOAD_MAC_SIZE = 32;
+
+// HMAC-SHA256 of an authenticated record : the packed seed record, then the payload
+// ciphertext segment by segment. Keyed with HMAC-SHA256( seed key, "rsteg payload mac" ),
+// the seed key itself stays an AES key only.
+class PayloadMac {
+public:
+    PayloadMac(const SeedRecord& seedRecord, const unsigned char* seedKey) {
+        static const unsigned char label[] = "rsteg payload mac";
+        unsigned char macKey[EVP_MAX_MD_SIZE];
+        unsigned int macKeyLength = 0;
+        ok = HMAC(EVP_sha256(), seedKey, 32, label, sizeof(label) - 1, macKey, &macKeyLength) != NULL;
+
+        key = ok ? EVP_PKEY_new_raw_private_key(EVP_PKEY_HMAC, NULL, macKey, macKeyLength) : NULL;
+        ctx = EVP_MD_CTX_new();
+        ok = key && ctx && EVP_DigestSignInit(ctx, NULL, EVP_sha256(), NULL, key) == 1;
+        OPENSSL_cleanse(macKey, sizeof(macKey));
+
+        unsigned char record[SEED_RECORD_MAX_SIZE];
+        update(record, packSeedRecord(seedRecord, record));
+    }
+
+    ~PayloadMac() {
+        EVP_MD_CTX_free(ctx);
+        EVP_PKEY_free(key);
+    }
+
+    PayloadMac(const PayloadMac&) = delete;
+    PayloadMac& operator=(const PayloadMac&) = delete;
+
+    void update(const unsigned char* data, size_t length) {
+        ok = ok && EVP_DigestSignUpdate(ctx, data, length) == 1;
+    }
+
+    // PAYLOAD_MAC_SIZE bytes into `tag`, once every segment is in
+    bool final(unsigned char* tag) {
+        size_t length = PAYLOAD_MAC_SIZE;
+        ok = ok && EVP_DigestSignFinal(ctx, tag, &length) == 1 && length == PAYLOAD_MAC_SIZE;
+        if (!ok) {
+            std::cerr << "Error:    unable to compute payload MAC" << std::endl;
+        }
+        return ok;
+    }
+
+    bool verify(const unsigned char* tag) {
+        unsigned char computed[PAYLOAD_MAC_SIZE];
+        return final(computed) && CRYPTO_memcmp(computed, tag, PAYLOAD_MAC_SIZE) == 0;
+    }
+
+private:
+    EVP_PKEY* key = NULL;
+    EVP_MD_CTX* ctx = NULL;
+    bool ok = false;
+};
+
+// AES-256-CTR IV of the keystream starting at payload byte segment * segmentPayloadBytes(bits)
+inline void segmentIv(const unsigned char* iv, unsigned long long segment, int bits, unsigned char* out) {
+    ctrCounterAt(iv, segment * (segmentPayloadBytes(bits) / AES_BLOCK_SIZE), out);
+}
+
+class SegmentEmbedder {
+public:
+    // `mapping` ( optional ) backs `payload`, consumed segments are released from it.
+    // `mac` ( optional ) takes the ciphertext of each segment.
+    SegmentEmbedder(const unsigned char* payload, unsigned long long payloadSize, const SeedRecord& seedRecord,
+                    const unsigned char* key, ThreadPool& pool, MappedFile* mapping = nullptr, PayloadMac* mac = nullptr)
+        : payload(payload), payloadSize(payloadSize), mapping(mapping), mac(mac), seedRecord(seedRecord), key(key), pool(pool),
+          positions(seedRecord) {}
+
+    // embed into container bytes [offset, offset + length), windows must not go backwards
+    bool embed(unsigned char* carrier, unsigned long long length, unsigned long long offset) {
+        unsigned long long end = std::min(offset + length, seedRecord.numPositions);
+
+        for (unsigned long long position = offset; position < end; ) {
+            unsigned long long segment = position / SEGMENT_POSITIONS;
+            if (segment != current && !load(segment)) {
+                return false;
+            }
+
+            unsigned long long first = segment * SEGMENT_POSITIONS;
+            unsigned long long last = std::min(end, first + positions.size());
+
+            StageTimer timer(STAGE_EMBED, last - position);
+            positions.visit([&](const auto& order) {
+                encode_lsb_parallel(carrier + (position - offset), last - position, position - first, chunk, order, pool,
+                                    seedRecord.bits);
+            });
+            position = last;
+        }
+
+        return true;
+    }
+
+private:
+    const unsigned char* payload;
+    unsigned long long payloadSize;
+    MappedFile* mapping;
+    PayloadMac* mac;
+    const SeedRecord& seedRecord;
+    const unsigned char* key;
+    ThreadPool& pool;
+    SegmentPositions positions;
+    std::vector<unsigned char> chunk;
+    unsigned long long current = ~0ULL;
+
+    // encrypt the plaintext of `segment` straight out of the payload
+    bool load(unsigned long long segment) {
+        positions.load(segment, pool);
+
+        chunk.resize(payloadForPositions(positions.size(), seedRecord.bits));
+
+        unsigned long long first = segment * segmentPayloadBytes(seedRecord.bits);
+        if (first + chunk.size() > payloadSize) {
+            std::cerr << "Error:    unable to read embed file" << std::endl;
+            return false;
+        }
+
+        StageTimer encryptTimer(STAGE_ENCRYPT, chunk.size());
+        unsigned char iv[AES_BLOCK_SIZE];
+        segmentIv(seedRecord.iv, segment, seedRecord.bits, iv);
+        if (!ctr_crypt(payload + first, chunk.size(), key, iv, chunk.data(), pool)) {
+            return false;
+        }
+        if (mac != nullptr) {
+            mac->update(chunk.data(), chunk.size());
+        }
+        if (mapping != nullptr) {
+            mapping->release(first, chunk.size());
+        }
+
+        current = segment;
+        return true;
+    }
+};
+
+class SegmentExtractor {
+public:
+    // `sink` receives each decrypted segment in payload order, `mac` ( optional ) its ciphertext first
+    SegmentExtractor(const SeedRecord& seedRecord, const unsigned char* key, ThreadPool& pool,
+                     const std::function<bool(const std::vector<unsigned char>&)>& sink, PayloadMac* mac = nullptr)
+        : seedRecord(seedRecord), key(key), pool(pool), sink(sink), mac(mac), positions(seedRecord) {}
+
+    // extract from container bytes [offset, offset + length), windows must not go backwards
+    bool extract(const unsigned char* carrier, unsigned long long length, unsigned long long offset) {
+        unsigned long long end = std::min(offset + length, seedRecord.numPositions);
+
+        for (unsigned long long position = offset; position < end; ) {
+            unsigned long long segment = position / SEGMENT_POSITIONS;
+            if (segment != current) {
+                positions.load(segment, pool);
+                chunk.assign(payloadForPositions(positions.size(), seedRecord.bits), 0);
+                current = segment;
+            }
+
+            unsigned long long first = segment * SEGMENT_POSITIONS;
+            unsigned long long last = std::min(end, first + positions.size());
+
+            {
+                StageTimer timer(STAGE_EXTRACT, last - position);
+                positions.visit([&](const auto& order) {
+                    decode_lsb_parallel(carrier + (position - offset), last - position, position - first, order, chunk, pool,
+                                        seedRecord.bits);
+                });
+            }
+            position = last;
+
+            // every position of the segment has been read
+            if (position == first + positions.size() && !flush(segment)) {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    bool complete() const {
+        return flushed * SEGMENT_POSITIONS >= seedRecord.numPositions;
+    }
+
+private:
+    const SeedRecord& seedRecord;
+    const unsigned char* key;
+    ThreadPool& pool;
+    std::function<bool(const std::vector<unsigned char>&)> sink;
+    PayloadMac* mac;
+    SegmentPositions positions;
+    std::vector<unsigned char> chunk;
+    unsigned long long current = ~0ULL;
+    unsigned long long flushed = 0;
+
+    bool flush(unsigned long long segment) {
+        StageTimer timer(STAGE_DECRYPT, chunk.size());
+        if (mac != nullptr) {
+            mac->update(chunk.data(), chunk.size());
+        }
+        unsigned char iv[AES_BLOCK_SIZE];
+        segmentIv(seedRecord.iv, segment, seedRecord.bits, iv);
+        bool decrypted = ctr_crypt(chunk.data(), chunk.size(), key, iv, chunk.data(), pool);
+        timer.stop();
+
+        if (!decrypted || !sink(chunk)) {
+            return false;
+        }
+
+        ++flushed;
+        return true;
+    }
+};
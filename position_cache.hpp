@@ -0,0 +1,207 @@
+#include <iostream>
+#include <vector>
+#include <string>
+#include <cstdio>
+#include <cstring>
+#include <climits>
+#include <algorithm>
+#include <filesystem>
+#include <openssl/hmac.h>
+#include <openssl/rand.h>
+#include "thread_pool.hpp"
+
+// On-disk cache of legacy std::shuffle position tables, so repeated extraction
+// from the same v1 / v2 container maps a file instead of reshuffling. Entries are
+// named by HMAC-SHA256 ( seed key, algorithm, seed, count ) and encrypted with
+// AES-256-CTR under the seed key:
+//
+//  [ "RSPC" ][ version ][ algorithm ][ 2 reserved ][ count 8 LE ][ IV 16 ][ count x int32 ]
+//
+// Tables are stored in host byte order. A table that does not decrypt to a
+// permutation is dropped and regenerated. Files are evicted least recently used
+// first once the directory exceeds its byte budget, hits refresh the mtime.
+// Include after aes_helpers.hpp and file_helpers.hpp.
+
+const unsigned char POSITION_CACHE_VERSION = 1;
+const unsigned char POSITION_CACHE_LEGACY_SHUFFLE = 1;
+const size_t POSITION_CACHE_HEADER_SIZE = 32;
+const size_t POSITION_CACHE_CHUNK_BYTES = 16 << 20;
+
+// smaller tables shuffle faster than they load
+const unsigned long long POSITION_CACHE_MIN_POSITIONS = 1 << 20;
+
+struct PositionCache {
+    std::string directory;                  // empty : cache disabled
+    unsigned long long maxBytes = 0;        // eviction threshold for the whole directory
+    const unsigned char* key = nullptr;     // 256-bit seed key
+};
+
+inline bool positionCacheEnabled(const PositionCache& cache, unsigned long long count) {
+    return !cache.directory.empty() && cache.key != nullptr && count >= POSITION_CACHE_MIN_POSITIONS &&
+           count <= static_cast<unsigned long long>(INT_MAX);
+}
+
+inline std::filesystem::path positionCachePath(const PositionCache& cache, unsigned long long seed, unsigned long long count) {
+    unsigned char message[17];
+    message[0] = POSITION_CACHE_LEGACY_SHUFFLE;
+    for (int i = 0; i < 8; ++i) {
+        message[1 + i] = static_cast<unsigned char>(seed >> (8 * i));
+        message[9 + i] = static_cast<unsigned char>(count >> (8 * i));
+    }
+
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    unsigned int digestLength = 0;
+    HMAC(EVP_sha256(), cache.key, 32, message, sizeof(message), digest, &digestLength);
+
+    static const char hex[] = "0123456789abcdef";
+    std::string name;
+    for (unsigned int i = 0; i < digestLength; ++i) {
+        name += hex[digest[i] >> 4];
+        name += hex[digest[i] & 0xF];
+    }
+
+    return std::filesystem::path(cache.directory) / (name + ".pos");
+}
+
+// every index in [0, count) exactly once
+inline bool isPermutation(const std::vector<int>& positions) {
+    std::vector<bool> seen(positions.size(), false);
+    for (int position : positions) {
+        if (position < 0 || static_cast<size_t>(position) >= positions.size() || seen[position]) {
+            return false;
+        }
+        seen[position] = true;
+    }
+
+    return true;
+}
+
+inline bool loadCachedPositions(const PositionCache& cache, unsigned long long seed, unsigned long long count,
+                         ThreadPool& pool, std::vector<int>& positions) {
+    if (!positionCacheEnabled(cache, count)) {
+        return false;
+    }
+
+    std::error_code error;
+    std::filesystem::path path = positionCachePath(cache, seed, count);
+    if (std::filesystem::file_size(path, error) != POSITION_CACHE_HEADER_SIZE + count * sizeof(int) || error) {
+        return false;
+    }
+
+    MappedFile file;
+    if (!file.open(path.string().c_str())) {
+        return false;
+    }
+
+    const unsigned char* header = file.data();
+    unsigned long long storedCount = 0;
+    for (int i = 0; i < 8; ++i) {
+        storedCount |= static_cast<unsigned long long>(header[8 + i]) << (8 * i);
+    }
+
+    bool valid = memcmp(header, "RSPC", 4) == 0 && header[4] == POSITION_CACHE_VERSION &&
+                 header[5] == POSITION_CACHE_LEGACY_SHUFFLE && storedCount == count;
+    if (valid) {
+        positions.resize(count);
+        valid = ctr_crypt(header + POSITION_CACHE_HEADER_SIZE, count * sizeof(int), cache.key, header + 16,
+                          reinterpret_cast<unsigned char*>(positions.data()), pool) && isPermutation(positions);
+    }
+
+    if (!valid) {
+        std::cerr << "Error:    discarding corrupt position cache entry " << path.string() << std::endl;
+        std::filesystem::remove(path, error);
+        positions.clear();
+        return false;
+    }
+
+    std::filesystem::last_write_time(path, std::filesystem::file_time_type::clock::now(), error);
+
+    return true;
+}
+
+// drop least recently used entries until the directory fits its budget
+inline void evictCachedPositions(const PositionCache& cache) {
+    struct Entry {
+        std::filesystem::file_time_type used;
+        unsigned long long size;
+        std::filesystem::path path;
+    };
+
+    std::error_code error;
+    std::vector<Entry> entries;
+    unsigned long long total = 0;
+    for (const auto& item : std::filesystem::directory_iterator(cache.directory, error)) {
+        if (item.path().extension() != ".pos" || !item.is_regular_file(error)) {
+            continue;
+        }
+        Entry entry{item.last_write_time(error), item.file_size(error), item.path()};
+        total += entry.size;
+        entries.push_back(entry);
+    }
+
+    std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) { return a.used < b.used; });
+    for (const Entry& entry : entries) {
+        if (total <= cache.maxBytes) {
+            break;
+        }
+        if (std::filesystem::remove(entry.path, error)) {
+            total -= entry.size;
+        }
+    }
+}
+
+// Encrypts the table chunk by chunk into a temporary file that is renamed into
+// place, so concurrent readers never see a partial entry. Failures only cost
+// the cache entry.
+inline void storeCachedPositions(const PositionCache& cache, unsigned long long seed, const std::vector<int>& positions, ThreadPool& pool) {
+    unsigned long long count = positions.size();
+    if (!positionCacheEnabled(cache, count) || count * sizeof(int) + POSITION_CACHE_HEADER_SIZE > cache.maxBytes) {
+        return;
+    }
+
+    std::error_code error;
+    std::filesystem::create_directories(cache.directory, error);
+
+    unsigned char header[POSITION_CACHE_HEADER_SIZE] = {'R', 'S', 'P', 'C', POSITION_CACHE_VERSION, POSITION_CACHE_LEGACY_SHUFFLE};
+    for (int i = 0; i < 8; ++i) {
+        header[8 + i] = static_cast<unsigned char>(count >> (8 * i));
+    }
+    if (RAND_bytes(header + 16, AES_BLOCK_SIZE) != 1) {
+        return;
+    }
+
+    std::filesystem::path path = positionCachePath(cache, seed, count);
+    std::filesystem::path temporary = path;
+    temporary += ".tmp" + std::to_string(header[16] | header[17] << 8 | header[18] << 16);
+
+    FILE* fp = fopen(temporary.string().c_str(), "wb");
+    if (!fp) {
+        return;
+    }
+
+    bool written = fwrite(header, 1, sizeof(header), fp) == sizeof(header);
+    const unsigned char* table = reinterpret_cast<const unsigned char*>(positions.data());
+    unsigned long long tableBytes = count * sizeof(int);
+    std::vector<unsigned char> chunk(std::min<unsigned long long>(tableBytes, POSITION_CACHE_CHUNK_BYTES));
+
+    for (unsigned long long offset = 0; written && offset < tableBytes; offset += chunk.size()) {
+        size_t length = static_cast<size_t>(std::min<unsigned long long>(chunk.size(), tableBytes - offset));
+        unsigned char counter[AES_BLOCK_SIZE];
+        ctrCounterAt(header + 16, offset / AES_BLOCK_SIZE, counter);
+        written = ctr_crypt(table + offset, length, cache.key, counter, chunk.data(), pool) &&
+                  fwrite(chunk.data(), 1, length, fp) == length;
+    }
+
+    if (fclose(fp) != 0 || !written) {
+        std::filesystem::remove(temporary, error);
+        return;
+    }
+
+    std::filesystem::rename(temporary, path, error);
+    if (error) {
+        std::filesystem::remove(temporary, error);
+        return;
+    }
+
+    evictCachedPositions(cache);
+}
@@ -1,40 +1,102 @@
-#include <iomanip>
+#include <iostream>
 #include <algorithm>
+#include <cstring>
+#include <map>
+#include <thread>
 #include <chrono>
-#include "io_helpers.hpp"
-#include "lsb_rand.hpp"
-#include "aes_helpers.hpp"
+#include <iomanip>
+#include "librsteg.hpp"
+#include "batch_helpers.hpp"
+#include "serve_helpers.hpp"
+
+// long options taking a value, "--name value" or "--name=value"
+const std::vector<std::string> VALUE_OPTIONS = {"--png-level", "--png-filter", "--simd", "--threads", "--jobs", "--bits", "--compress", "--compress-level", "--summary", "--socket", "--cache-dir", "--cache-size", "--positions", "--max-memory"};
+
+// long options whose value is optional, "--name" or "--name=value"
+const std::vector<std::string> FLAG_OPTIONS = {"--stats", "--json"};
+
+// strip long options out of argv, leaving the positional arguments in place
+bool extractOptions(int& argc, char** argv, std::map<std::string, std::string>& options) {
+    int kept = 1;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg.rfind("--", 0) != 0 || arg == "--help") {
+            argv[kept++] = argv[i];
+            continue;
+        }
+
+        std::string name = arg;
+        std::string value;
+        size_t eq = arg.find('=');
+        if (eq != std::string::npos) {
+            name = arg.substr(0, eq);
+            value = arg.substr(eq + 1);
+        }
 
-#ifdef _WIN32
-    const unsigned int MIN = UINT32_MAX;
-    const unsigned long long MAX = ULONG_MAX;
-#else
-    const unsigned int MIN = UINT16_MAX;
-    // const unsigned long long MAX = ULONG_MAX;   // overflow on unix
-    const unsigned int MAX = UINT32_MAX;
-#endif
+        if (std::find(FLAG_OPTIONS.begin(), FLAG_OPTIONS.end(), name) != FLAG_OPTIONS.end()) {
+            options[name] = value;
+            continue;
+        }
 
-unsigned long long generateSeed(int numPositions) {
+        if (std::find(VALUE_OPTIONS.begin(), VALUE_OPTIONS.end(), name) == VALUE_OPTIONS.end()) {
+            std::cerr << "unknown option " << name << std::endl << "rsteg --help for more details." << std::endl;
+            return false;
+        }
+
+        if (eq == std::string::npos) {
+            if (i + 1 >= argc) {
+                std::cerr << "missing value for " << name << std::endl;
+                return false;
+            }
+            value = argv[++i];
+        }
+
+        options[name] = value;
+    }
+
+    argc = kept;
+
+    return true;
+}
+
+bool parseIntOption(const std::map<std::string, std::string>& options, const std::string& name, int minValue, int maxValue, int& value) {
+    auto it = options.find(name);
+    if (it == options.end()) {
+        return true;
+    }
 
-    std::random_device rd;
-    std::uniform_int_distribution<unsigned long long> distribution(MIN, MAX);
-    unsigned long long seedValue = distribution(rd);
+    char* end = nullptr;
+    long parsed = strtol(it->second.c_str(), &end, 10);
+    if (it->second.empty() || *end != '\0' || parsed < minValue || parsed > maxValue) {
+        std::cerr << "Error:    " << name << " expects a value in [ " << minValue << " - " << maxValue << " ]" << std::endl;
+        return false;
+    }
 
-    int size = static_cast<int>(log10(numPositions) + 1);
+    value = static_cast<int>(parsed);
 
-    std::stringstream seedStream;
-    seedStream << seedValue << numPositions << size;
+    return true;
+}
 
-    unsigned long long combinedValue;
-    seedStream >> combinedValue;
+bool parsePngOptions(const std::map<std::string, std::string>& options, RstegOptions& rstegOptions) {
+    if (!parseIntOption(options, "--png-level", 0, 9, rstegOptions.pngLevel)) {
+        return false;
+    }
 
-    std::cout << "using seed:   " << combinedValue << std::endl;
+    auto filter = options.find("--png-filter");
+    if (filter != options.end()) {
+        rstegOptions.pngFilter = filter->second;
+    }
 
-    return combinedValue;
+    return rstegCheckOptions(rstegOptions) == RSTEG_OK;
 }
 
 // Parse args
-bool parseArgs (int& argc, char** argv, std::vector<int>& index){
+bool parseArgs (int& argc, char** argv, std::vector<int>& index, std::map<std::string, std::string>& options){
+
+    if (!extractOptions(argc, argv, options)) {
+        return false;
+    }
 
     std::vector<std::string> args;
     int i = 0;
@@ -52,16 +114,22 @@ bool parseArgs (int& argc, char** argv, std::vector<int>& index){
         std::cout << "Written By Aqib Khan\n";
         std::cout << "This software is distributed under the MIT License\n\n";
         std::cout << "Available modes:\n";
-        std::cout << "+-------+-------------------------------------------------------------------+\n";
-        std::cout << "| Mode  | Description                                                       |\n";
-        std::cout << "+-------+-------------------------------------------------------------------+\n";
-        std::cout << "| enc   | encrypt file and embed in container                               |\n";
-        std::cout << "| dec   | extract from container and decrypt files                          |\n";
+        std::cout << "+--------+------------------------------------------------------------------+\n";
+        std::cout << "| Mode   | Description                                                      |\n";
+        std::cout << "+--------+------------------------------------------------------------------+\n";
+        std::cout << "| enc    | encrypt file and embed in container                              |\n";
+        std::cout << "| dec    | extract from container and decrypt files                         |\n";
+        std::cout << "| batch  | run enc / dec jobs listed in a CSV or JSONL manifest             |\n";
+        std::cout << "| probe  | container capacity per LSB depth, read from headers only         |\n";
+        std::cout << "| serve  | enc / dec jobs over a Unix socket, keys and workers kept warm    |\n";
+        std::cout << "| client | send an enc / dec job to a running rsteg serve                   |\n";
         std::cout << "+------------------+--------------------------------------------------------+\n";
         std::cout << "| Symmetric Mode   | Description                                            |\n";
         std::cout << "+------------------+--------------------------------------------------------+\n";
-        std::cout << "| AES-256 CBC      | Advanced Encryption Standard with 256-bit keys         |\n";
-        std::cout << "|                  | in Cipher Block Chaining (CBC) mode.                   |\n";
+        std::cout << "| AES-256 CTR      | Advanced Encryption Standard with 256-bit keys         |\n";
+        std::cout << "|                  | in Counter (CTR) mode, payloads [ -mk ].               |\n";
+        std::cout << "| AES-256 CBC      | Cipher Block Chaining (CBC) mode, seed record [ -sk ]  |\n";
+        std::cout << "|                  | and payloads of containers from older releases.        |\n";
         std::cout << "+------------------+--------------------------------------------------------+\n\n";
         std::cout << "Options:\n";
         std::cout << "+---------+-----------------------------------------------------------------+\n";
@@ -80,7 +148,33 @@ bool parseArgs (int& argc, char** argv, std::vector<int>& index){
         std::cout << "|  -m     | path to file                                                    |\n";
         std::cout << "|  -mk    | path to 256-bit AES message key file                            |\n";
         std::cout << "|  -sk    | path to 256-bit AES seed key file                               |\n";
-        std::cout << "+---------+-----------------------------------------------------------------+\n";
+        std::cout << "+---------+-----------------------------------------------------------------+\n\n";
+        std::cout << "Tuning options:\n";
+        std::cout << "+----------------------+----------------------------------------------------+\n";
+        std::cout << "| Option               | Description                                        |\n";
+        std::cout << "+----------------------+----------------------------------------------------+\n";
+        std::cout << "| --png-level [0-9]    | PNG deflate level [ default 6 ]                    |\n";
+        std::cout << "| --png-filter [name]  | PNG row filter [ default adaptive ]                |\n";
+        std::cout << "|                      |     none | sub | up | avg | paeth | adaptive       |\n";
+        std::cout << "| --simd [level]       | LSB kernel instruction set [ default auto ]        |\n";
+        std::cout << "|                      |     auto | scalar | sse4.1 | avx2 | avx512         |\n";
+        std::cout << "| --threads [1-256]    | embed / extract / PNG threads [ default cores ]    |\n";
+        std::cout << "| --bits [1-4]         | carrier LSBs per byte on enc [ default 2 ]         |\n";
+        std::cout << "| --positions [order]  | embed order on enc [ default keyed ]               |\n";
+        std::cout << "|                      |     keyed | shuffle ( parallel Philox shuffle )    |\n";
+        std::cout << "| --compress [name]    | compress before encryption on enc [ default none ] |\n";
+        std::cout << "|                      |     none | zlib | zstd, skipped if incompressible |\n";
+        std::cout << "| --compress-level [n] | zlib 0 - 9, zstd 1 - 22 [ default 6 / 3 ]          |\n";
+        std::cout << "| --jobs [1-256]       | concurrent batch jobs [ default threads ]          |\n";
+        std::cout << "| --summary [file]     | batch JSONL summary [ default stdout ]             |\n";
+        std::cout << "| --socket [path]      | Unix socket of rsteg serve / client                |\n";
+        std::cout << "| --cache-dir [dir]    | cache legacy position tables, dec [ default off ]  |\n";
+        std::cout << "| --cache-size [MiB]   | cache budget, oldest used evicted [ default 1024 ] |\n";
+        std::cout << "| --max-memory [MiB]   | peak memory per run, split across batch jobs       |\n";
+        std::cout << "|                      |     spills to $TMPDIR, fails fast if it cannot fit |\n";
+        std::cout << "| --stats[=json]       | per stage time, bytes, MB/s and peak memory        |\n";
+        std::cout << "| --json               | probe results as one JSON object per container     |\n";
+        std::cout << "+----------------------+----------------------------------------------------+\n";
 
         return false;
     }
@@ -125,6 +219,77 @@ bool parseArgs (int& argc, char** argv, std::vector<int>& index){
                         (std::find(args.begin(), args.end(), "-o") - args.begin()) : -1);
     }
 
+    else if (strcmp(argv[1], "batch") == 0){
+        if (argc != 8) {
+            std::cerr << "usage: rsteg batch\n" << std::endl;
+            std::cerr << "          -f      [ manifest file ]" << std::endl;
+            std::cerr << "          -mk     [ message key file ]" << std::endl;
+            std::cerr << "          -sk     [ seed key file ]\n" << std::endl;
+            std::cerr << "rsteg --help for more information" << std::endl;
+
+            return false;
+        }
+
+        index.push_back(std::find(args.begin(), args.end(), "-f") - args.begin());
+        index.push_back(std::find(args.begin(), args.end(), "-mk") - args.begin());
+        index.push_back(std::find(args.begin(), args.end(), "-sk") - args.begin());
+    }
+
+    else if (strcmp(argv[1], "serve") == 0){
+        if (argc != 6 || options["--socket"].empty()) {
+            std::cerr << "usage: rsteg serve\n" << std::endl;
+            std::cerr << "          --socket [ socket path ]" << std::endl;
+            std::cerr << "          -mk      [ message key file ]" << std::endl;
+            std::cerr << "          -sk      [ seed key file ]" << std::endl;
+            std::cerr << "OPTIONAL: enc tuning options, --threads, --jobs\n" << std::endl;
+            std::cerr << "rsteg --help for more information" << std::endl;
+
+            return false;
+        }
+
+        index.push_back(std::find(args.begin(), args.end(), "-mk") - args.begin());
+        index.push_back(std::find(args.begin(), args.end(), "-sk") - args.begin());
+    }
+
+    else if (strcmp(argv[1], "client") == 0){
+        // keys and tuning options belong to the daemon
+        bool embed = argc > 2 && strcmp(argv[2], "enc") == 0;
+        bool extract = argc > 2 && strcmp(argv[2], "dec") == 0;
+        if ((!(embed && (argc == 7 || argc == 9)) && !(extract && (argc == 5 || argc == 7))) ||
+            options.size() != 1 || options["--socket"].empty()) {
+            std::cerr << "usage: rsteg client\n" << std::endl;
+            std::cerr << "          --socket [ socket path of rsteg serve ]" << std::endl;
+            std::cerr << "          enc -i [ container file ] -m [ embed file ] [ -o output image file ]" << std::endl;
+            std::cerr << "          dec -i [ container file ] [ -o output filename ]\n" << std::endl;
+            std::cerr << "rsteg --help for more information" << std::endl;
+
+            return false;
+        }
+
+        index.push_back(std::find(args.begin(), args.end(), "-i") - args.begin());
+        index.push_back(std::find(args.begin(), args.end(), "-o") != args.end() ?
+                        (std::find(args.begin(), args.end(), "-o") - args.begin()) : -1);
+        if (embed) {
+            index.push_back(std::find(args.begin(), args.end(), "-m") - args.begin());
+        }
+    }
+
+    else if (strcmp(argv[1], "probe") == 0){
+        for (int i = 2; i + 1 < argc && strcmp(argv[i], "-i") == 0; i += 2) {
+            index.push_back(i);
+        }
+
+        if (index.empty() || argc != 2 + 2 * static_cast<int>(index.size())) {
+            std::cerr << "usage: rsteg probe\n" << std::endl;
+            std::cerr << "          -i      [ container file ]" << std::endl;
+            std::cerr << "OPTIONAL: -i      [ more container files ... ]" << std::endl;
+            std::cerr << "          --json  [ one JSON object per container ]\n" << std::endl;
+            std::cerr << "rsteg --help for more information" << std::endl;
+
+            return false;
+        }
+    }
+
     for (int i=0; i<static_cast<int>(index.size()); ++i){
         if (std::count(index.begin(), index.end(), index[i]) > 1 || index[i] == argc) {
             std::cerr << "invalid arguments ... " << std::endl << "rsteg --help for more details." << std::endl;
@@ -135,44 +300,150 @@ bool parseArgs (int& argc, char** argv, std::vector<int>& index){
     return true;
 }
 
-std::string getFileExtension(const std::vector<unsigned char>& data) {
 
-    if (data[0] == 0x50 && data[1] == 0x4B && data[2] == 0x03 && data[3] == 0x04) {
-        return ".zip";
+double stageMbps(unsigned long long bytes, unsigned long long ns) {
+    return ns == 0 ? 0.0 : static_cast<double>(bytes) / (1024.0 * 1024.0) / (static_cast<double>(ns) / 1e9);
+}
+
+// --stats report, a table or a single JSON object line
+void printStats(const RstegStats& stats, const char* mode, RstegStatus status, int threads, unsigned long long wallNs, bool json) {
+    unsigned long long peak = rstegPeakMemory();
+    std::cout << std::setfill(' ');
+
+    if (json) {
+        std::cout << std::fixed << std::setprecision(3)
+                  << "{\"mode\":\"" << mode << "\",\"ok\":" << (status == RSTEG_OK ? "true" : "false")
+                  << ",\"threads\":" << threads << ",\"wall_ns\":" << wallNs << ",\"peak_rss_bytes\":" << peak
+                  << ",\"stages\":{";
+        bool first = true;
+        for (int stage = 0; stage < RSTEG_STAGE_COUNT; ++stage) {
+            if (stats.ns[stage] == 0) {
+                continue;
+            }
+            std::cout << (first ? "" : ",") << "\"" << rstegStageName(static_cast<RstegStage>(stage)) << "\":{"
+                      << "\"ns\":" << stats.ns[stage] << ",\"bytes\":" << stats.bytes[stage]
+                      << ",\"mb_per_s\":" << stageMbps(stats.bytes[stage], stats.ns[stage]) << "}";
+            first = false;
+        }
+        std::cout << "}}" << std::endl;
+        return;
     }
-    else if (data[0] == 0xFF && data[1] == 0xD8 && data[2] == 0xFF) {
-        return ".jpg";
+
+    std::cout << std::left << std::setw(18) << "stage" << std::right << std::setw(14) << "ms"
+              << std::setw(14) << "MB" << std::setw(12) << "MB/s" << std::endl;
+    for (int stage = 0; stage < RSTEG_STAGE_COUNT; ++stage) {
+        if (stats.ns[stage] == 0) {
+            continue;
+        }
+        std::cout << std::fixed << std::setprecision(3) << std::left << std::setw(18)
+                  << rstegStageName(static_cast<RstegStage>(stage)) << std::right
+                  << std::setw(14) << static_cast<double>(stats.ns[stage]) / 1e6
+                  << std::setw(14) << static_cast<double>(stats.bytes[stage]) / (1024.0 * 1024.0)
+                  << std::setw(12) << std::setprecision(1) << stageMbps(stats.bytes[stage], stats.ns[stage]) << std::endl;
     }
-    else if (data[0] == 0x52 && data[1] == 0x49 && data[2] == 0x46 && data[3] == 0x46) {
-        return ".wav";
+    std::cout << std::fixed << std::setprecision(3) << std::left << std::setw(18) << "total" << std::right
+              << std::setw(14) << static_cast<double>(wallNs) / 1e6 << std::endl;
+    std::cout << "threads:  " << threads << "    peak memory:  " << std::setprecision(1)
+              << static_cast<double>(peak) / (1024.0 * 1024.0) << " MB" << std::endl;
+}
+
+// one line per container : geometry, carrier bytes and the largest embed file per --bits
+bool printProbe(const char* containerPath, bool json) {
+    auto start = std::chrono::steady_clock::now();
+    RstegProbe probe;
+    RstegStatus status = rstegProbe(containerPath, probe);
+    double us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+
+    if (json) {
+        std::cout << std::fixed << std::setprecision(1) << "{\"input\":\"" << jsonEscape(containerPath) << "\""
+                  << ",\"ok\":" << (status == RSTEG_OK ? "true" : "false");
+        if (status == RSTEG_OK) {
+            std::cout << ",\"width\":" << probe.width << ",\"height\":" << probe.height << ",\"channels\":" << probe.channels
+                      << ",\"frames\":" << probe.frames << ",\"carrier_bytes\":" << probe.carrierBytes << ",\"capacity\":{";
+            for (int bits = 1; bits <= 4; ++bits) {
+                std::cout << (bits == 1 ? "" : ",") << "\"" << bits << "\":" << rstegCapacity(probe.carrierBytes, bits);
+            }
+            std::cout << "}";
+        } else {
+            std::cout << ",\"error\":\"" << rstegStatusMessage(status) << "\"";
+        }
+        std::cout << ",\"us\":" << us << "}" << std::endl;
+        return status == RSTEG_OK;
     }
-    else if (data[0] == 0x89 && data[1] == 0x50 && data[2] == 0x4E && data[3] == 0x47) {
-        return ".png";
+
+    if (status != RSTEG_OK) {
+        std::cerr << "Error:    " << containerPath << " : " << rstegStatusMessage(status) << std::endl;
+        return false;
     }
-    else if (data[0] == 0x25 && data[1] == 0x50 && data[2] == 0x44 && data[3] == 0x46) {
-        return ".pdf";
+
+    std::cout << containerPath << "    " << probe.width << " x " << probe.height << " x " << probe.channels
+              << "    frames:  " << probe.frames << "    capacity:";
+    for (int bits = 1; bits <= 4; ++bits) {
+        std::cout << "  [" << bits << "] " << rstegCapacity(probe.carrierBytes, bits) << " B";
     }
-    else if (data[0] == 0x47 && data[1] == 0x49 && data[2] == 0x46 && data[3] == 0x38) {
-        return ".gif";
+    std::cout << std::fixed << std::setprecision(1) << "    " << us << " us" << std::endl;
+
+    return true;
+}
+
+int main(int argc, char** argv) {
+    std::vector<int> index;
+    std::map<std::string, std::string> options;
+    if (!parseArgs(argc, argv, index, options)){
+        return 1;
     }
-    else if ((data[0] == 0x49 && data[1] == 0x44 && data[2] == 0x33) || 
-             (data[0] == 0xFF && data[1] == 0xFB) ||
-             (data[0] == 0xFF && data[1] == 0xF3)) {
-        return ".mp3";
+
+    if (options.count("--simd") && !rstegSetSimdLevel(options["--simd"])) {
+        std::cerr << "Error:    unknown --simd level " << options["--simd"] << std::endl;
+        return 1;
     }
 
-    return ".txt";
-}
+    int threads = static_cast<int>(std::min(256u, std::max(1u, std::thread::hardware_concurrency())));
+    if (!parseIntOption(options, "--threads", 1, 256, threads)) {
+        return 1;
+    }
 
+    RstegOptions rstegOptions;
+    rstegOptions.threads = threads;
+    rstegOptions.verbose = true;
 
-int main(int argc, char** argv) {
-    OpenSSL_add_all_algorithms();
-    ERR_load_crypto_strings();
+    // embed side only, extraction reads depth and compression from the trailer
+    if (!parseIntOption(options, "--bits", 1, 4, rstegOptions.bits) ||
+        !parseIntOption(options, "--compress-level", 0, 22, rstegOptions.compressionLevel)) {
+        return 1;
+    }
+    if (options.count("--compress")) {
+        rstegOptions.compression = options["--compress"];
+    }
+    if (options.count("--positions")) {
+        rstegOptions.positions = options["--positions"];
+    }
 
-    std::vector<int> index;
-    if (!parseArgs(argc, argv, index)){
+    int cacheMiB = 1024;
+    if (!parseIntOption(options, "--cache-size", 1, 1 << 20, cacheMiB)) {
         return 1;
     }
+    rstegOptions.positionCache = options.count("--cache-dir") ? options["--cache-dir"] : std::string();
+    rstegOptions.positionCacheBytes = static_cast<unsigned long long>(cacheMiB) << 20;
+
+    int maxMemoryMiB = 0;
+    if (!parseIntOption(options, "--max-memory", 1, 1 << 22, maxMemoryMiB)) {
+        return 1;
+    }
+    rstegOptions.maxMemory = static_cast<unsigned long long>(maxMemoryMiB) << 20;
+
+    bool stats = options.count("--stats") > 0;
+    bool statsJson = stats && options["--stats"] == "json";
+    if (stats && !statsJson && !options["--stats"].empty()) {
+        std::cerr << "Error:    --stats expects no value or json" << std::endl;
+        return 1;
+    }
+
+    RstegStats stageStats;
+    auto start = std::chrono::steady_clock::now();
+    auto wallNs = [&] {
+        return static_cast<unsigned long long>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+    };
 
     if (strcmp(argv[1], "enc") == 0) {
 
@@ -184,130 +455,36 @@ int main(int argc, char** argv) {
 
         std::cout << outputImagePath << std::endl;
 
-        std::pair<std::vector<int>, std::vector<unsigned char>> image;
-        int length = strlen(inputImagePath);
-        if (length >= 4 && strcmp(inputImagePath + length - 4, ".avi") == 0) {
-            image = readVideo(inputImagePath);
-        } else {
-            image = readImage(inputImagePath);
-        }
-
-        std::vector<unsigned char> fileContents;
-        if(!readBinaryFile(inputFile, fileContents)){
-            std::cerr << "Error:    unable to read embed file" << std::endl;
+        if (!parsePngOptions(options, rstegOptions)) {
             return 1;
         }
 
-        unsigned char messageKey[32];
-        if(!readAes256KeyFromFile(messageKeyFile, messageKey, sizeof(messageKey))){
-            return -1;
-        }
-
-        std::vector<unsigned char> encryptedBytes(fileContents.size());
-
-        int encryptedByteslength = encrypt(fileContents, static_cast<int>(fileContents.size()), messageKey, messageKey, encryptedBytes);
-
-        /*  //  debug snippet
-
-        std::cout << "AES-256 encrypted bytes: " << std::endl;
-        bool first = true;
-        for (auto ch : encryptedBytes) {
-            if (!first) {
-                std::cout << ' ';
-            }
-            std::cout << std::hex << std::setw(2) << std::setfill('0') << static_cast<unsigned int>(static_cast<unsigned char>(ch));
-            first = false;
+        if (strcmp(outputImagePath, ".") == 0) {
+            int length = strlen(inputImagePath);
+            bool isVideo = length >= 4 && strcmp(inputImagePath + length - 4, ".avi") == 0;
+            outputImagePath = isVideo ? "./out.avi" : "./out.png";
         }
-        std::cout << std::dec << std::endl;  */
 
-        // Calculate size for encoding
-        int numPositions = (static_cast<long>(encryptedBytes.size()) * 8) / (4 * 2) * 4; // this works but how ??
-
-        std::cout << std::fixed << std::setprecision(1) << "minimum required container size:   " << static_cast<double>(numPositions)/1024.0 << " KB" << std::endl; 
-
-        if (numPositions > image.second.size()) {
-            std::cerr << "Error:    insufficient container size" << std::endl;
-            return 1;
-        }
-
-        std::cout << "file size:    " << std::fixed << std::setprecision(1) << static_cast<double>(encryptedBytes.size())/1024.0 << " KB" << std::endl;
-        std::cout << "container size:   " << std::fixed << std::setprecision(1) << static_cast<double>(image.second.size())/1024.0 << " KB" << std::endl;
-
-        unsigned char seedKey[32];
-        if(!readAes256KeyFromFile(seedKeyFile, seedKey, 32)){
+        auto keyStart = std::chrono::steady_clock::now();
+        unsigned char messageKey[RSTEG_KEY_SIZE];
+        unsigned char seedKey[RSTEG_KEY_SIZE];
+        if (rstegReadKeyFile(messageKeyFile, messageKey) != RSTEG_OK || rstegReadKeyFile(seedKeyFile, seedKey) != RSTEG_OK) {
             return -1;
         }
+        stageStats.ns[RSTEG_STAGE_KEY_LOAD] = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - keyStart).count();
+        stageStats.bytes[RSTEG_STAGE_KEY_LOAD] = 2 * RSTEG_KEY_SIZE;
 
-        unsigned long long Seed = generateSeed(numPositions);
-               
-        if (Seed != 0) {
-            unsigned char seedBytes[sizeof(Seed)];
-            for (long long unsigned int i = 0; i < sizeof(Seed); ++i) {
-                seedBytes[i] = (Seed >> (8 * i)) & 0xFF;
-            }
-
-            unsigned char encryptedSeed[AES_BLOCK_SIZE];
-            int encryptedSeedLength = encrypt_seed(seedBytes, sizeof(seedBytes), seedKey, seedKey, encryptedSeed);
-
-            std::cout << "AES-256 encrypted seed bytes:     ";
-            for (int i = 0; i < encryptedSeedLength; ++i) {
-                if (i != 0) {
-                    std::cout << ' ';
-                }
-                std::cout << std::hex << std::setw(2) << std::setfill('0') << static_cast<int>(encryptedSeed[i]);
-            }
-            std::cout << std::dec << std::endl;
-
-            auto start = std::chrono::high_resolution_clock::now();
-            std::vector<int> positions = generateRandomPositions(image.second, Seed);
-            auto stop = std::chrono::high_resolution_clock::now();
-
-            auto duration = std::chrono::duration_cast<std::chrono::seconds>(stop - start);
-            std::cout << "generated encoding sequence in " << std::setprecision(2) << static_cast<double>(duration.count()) << " s" << std::endl; 
-
-            // works now
-            encode_lsb(image.second, encryptedBytes, positions);
-
-            std::vector<unsigned char> encodedSeedBytes;
-            for (int i = 0; i < encryptedSeedLength; ++i) {
-                encodedSeedBytes.push_back(encryptedSeed[i]);
-            }
-            encodedSeedBytes.push_back(encryptedSeedLength);
-
-            length = strlen(inputImagePath);
-            if (length >= 4 && strcmp(inputImagePath + length - 4, ".avi") == 0 && strcmp(outputImagePath, ".") == 0) {
-                outputImagePath = "./out.avi";
-                if(!writeVideo(outputImagePath, image.second, image.first[0], image.first[1], image.first[2])) {
-                    std::cerr << "Error:    failed to write to container" << std::endl;
-                    return 1;
-                }
-            } else if (length >= 4 && strcmp(inputImagePath + length - 4, ".avi") == 0 && strcmp(outputImagePath, ".") != 0){
-                if(!writeImage(outputImagePath, image.second, image.first[0], image.first[1], image.first[2])) {
-                    std::cerr << "Error:    failed to write to container" << std::endl;
-                    return 1;
-                }
-            } else {
-                outputImagePath = "./out.png";
-                if(!writeImage(outputImagePath, image.second, image.first[0], image.first[1], image.first[2])) {
-                    std::cerr << "Error:    failed to write to container" << std::endl;
-                    return 1;
-                }
-            }
-
-            // write the seed
-            std::ofstream outputFile(outputImagePath, std::ios::out | std::ios::app | std::ios::binary);
-            if (outputFile.is_open()) {
-                outputFile.write(reinterpret_cast<char*>(encodedSeedBytes.data()), encodedSeedBytes.size());
-                outputFile.close();
-                std::cout << "seed written to container." << std::endl;
-            } else {
-                std::cerr << "Error:    failed to embed seed bytes." << std::endl;
-            }
-
+        Rsteg rsteg(rstegOptions);
+        RstegStatus status = rsteg.embedFile(inputImagePath, inputFile, outputImagePath, messageKey, seedKey, stats ? &stageStats : nullptr);
+        // the library has already reported the failure
+        if (status == RSTEG_OK) {
             std::cout << "successfully created embedded container:      " << outputImagePath << std::endl;
+        }
 
-        } else {
-            std::cerr << "Error:    Unknown" << std::endl;
+        if (stats) {
+            printStats(stageStats, "enc", status, threads, wallNs(), statsJson);
+        }
+        if (status != RSTEG_OK) {
             return 1;
         }
 
@@ -317,122 +494,133 @@ int main(int argc, char** argv) {
         const char* messageKeyFile = argv[++index[1]];
         const char* seedKeyFile = argv[++index[2]];
         std::string outputFilename = index[3] == -1 ? "." : argv[++index[3]];
-        
-        std::vector<unsigned char> encryptedSeed = decodeSeedBytes(inputImagePath);
-
-        size_t i = encryptedSeed.size()-1;
 
-        // remove any padding
-        while(true) {
-            if(encryptedSeed[i] == 0x00) {
-                encryptedSeed.pop_back();
-            } else {
-                break;
-            }
-            --i;
-        }
-
-        unsigned char seedKey[32];
-        if(!readAes256KeyFromFile(seedKeyFile, seedKey, 32)){
+        auto keyStart = std::chrono::steady_clock::now();
+        unsigned char messageKey[RSTEG_KEY_SIZE];
+        unsigned char seedKey[RSTEG_KEY_SIZE];
+        if (rstegReadKeyFile(seedKeyFile, seedKey) != RSTEG_OK || rstegReadKeyFile(messageKeyFile, messageKey) != RSTEG_OK) {
             return -1;
         }
-
-        std::cout << "extracted seed:   ";
-        for (size_t i = 0; i < encryptedSeed.size(); ++i) {
-            if (i != 0) {
-                std::cout << ' ';
-            }
-            std::cout << std::hex << std::setw(2) << std::setfill('0') << static_cast<int>(encryptedSeed[i]);
+        stageStats.ns[RSTEG_STAGE_KEY_LOAD] = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - keyStart).count();
+        stageStats.bytes[RSTEG_STAGE_KEY_LOAD] = 2 * RSTEG_KEY_SIZE;
+
+        std::string outputPath;
+        Rsteg rsteg(rstegOptions);
+        RstegStatus status = rsteg.extractFile(inputImagePath, outputFilename, messageKey, seedKey, outputPath, stats ? &stageStats : nullptr);
+        // the library has already reported the failure
+        if (status == RSTEG_OK) {
+            std::cout << "reconstructed the file:   " << outputPath << std::endl;
         }
-        std::cout << std::dec << std::endl;
 
-        unsigned long long decryptedSeed = 0;
-        if(decrypt_seed(encryptedSeed.data(), static_cast<int>(encryptedSeed.size()), seedKey, seedKey, reinterpret_cast<unsigned char*>(&decryptedSeed)) < 0) {
-            std::cerr << "Error:    failed to decrypt seed" << std::endl;
+        if (stats) {
+            printStats(stageStats, "dec", status, threads, wallNs(), statsJson);
+        }
+        if (status != RSTEG_OK) {
             return 1;
         }
 
-        std::pair<std::vector<int>, std::vector<unsigned char>> stegoImage;
+    } else if (strcmp(argv[1], "batch") == 0) {
 
-        int length = strlen(inputImagePath);
-        if (length >= 4 && strcmp(inputImagePath + length - 4, ".avi") == 0) {
-            stegoImage = readVideo(inputImagePath);
-        } else {
-            stegoImage = readImage(inputImagePath);
+        const char* manifestPath = argv[++index[0]];
+        const char* messageKeyFile = argv[++index[1]];
+        const char* seedKeyFile = argv[++index[2]];
+
+        int jobs = threads;
+        if (!parseIntOption(options, "--jobs", 1, 256, jobs) || !parsePngOptions(options, rstegOptions)) {
+            return 1;
         }
+        rstegOptions.jobs = jobs;
+        rstegOptions.verbose = false;
 
-        std::cout << "decrypted seed:   " << decryptedSeed << std::endl;
+        // keys are parsed once for the whole manifest
+        unsigned char messageKey[RSTEG_KEY_SIZE];
+        unsigned char seedKey[RSTEG_KEY_SIZE];
+        if (rstegReadKeyFile(messageKeyFile, messageKey) != RSTEG_OK || rstegReadKeyFile(seedKeyFile, seedKey) != RSTEG_OK) {
+            return -1;
+        }
 
-        auto start = std::chrono::high_resolution_clock::now();
-        std::vector<int> positions = generateRandomPositions(stegoImage.second, decryptedSeed);
-        auto stop = std::chrono::high_resolution_clock::now();
+        std::vector<RstegJob> manifest;
+        if (!readManifest(manifestPath, manifest)) {
+            return 1;
+        }
 
-        auto duration = std::chrono::duration_cast<std::chrono::seconds>(stop - start);
-        std::cout << "generated encoding sequence in " << std::setprecision(2) << static_cast<double>(duration.count()) << " s" << std::endl; 
+        std::vector<RstegJobResult> results;
+        Rsteg rsteg(rstegOptions);
 
-        std::vector<unsigned char> extractedBytes = decode_file(stegoImage.second, positions);
+        auto start = std::chrono::steady_clock::now();
+        rsteg.batch(manifest, messageKey, seedKey, results);
+        auto stop = std::chrono::steady_clock::now();
 
-        /*  // debug snippet
+        unsigned int runners = static_cast<unsigned int>(std::min<size_t>(jobs, manifest.size()));
+        double seconds = std::chrono::duration<double>(stop - start).count();
 
-        std::cout << "extracted bytes: " << std::endl;
-        bool first = true;
-        for (auto ch : extractedBytes) {
-            if (!first) {
-                std::cout << ' '; // Add a space separator
+        if (options.count("--summary")) {
+            std::ofstream summary(options["--summary"]);
+            if (!summary.is_open()) {
+                std::cerr << "Error:    unable to write " << options["--summary"] << std::endl;
+                return 1;
             }
-            std::cout << std::hex << std::setw(2) << std::setfill('0') << static_cast<unsigned int>(static_cast<unsigned char>(ch));
-            first = false;
+            writeBatchSummary(summary, manifest, results, seconds, threads, runners);
+        } else {
+            writeBatchSummary(std::cout, manifest, results, seconds, threads, runners);
         }
-        std::cout << std::dec << std::endl;  */
-
-        i = extractedBytes.size()-1;
 
-        // remove any padding
-        while(true) {
-            if(extractedBytes[i] == 0x00) {
-                extractedBytes.pop_back();
-            } else {
-                break;
+        for (const RstegJobResult& result : results) {
+            if (result.status != RSTEG_OK) {
+                return 1;
             }
-            --i;
-        }        
-
-        unsigned char messageKey[32];
-        if(!readAes256KeyFromFile(messageKeyFile, messageKey, sizeof(messageKey))){
-            return -1;
         }
 
-        std::vector<unsigned char> finalMessageBytes(extractedBytes.size());
+    } else if (strcmp(argv[1], "serve") == 0) {
+
+        const char* messageKeyFile = argv[++index[0]];
+        const char* seedKeyFile = argv[++index[1]];
 
-        if(decrypt(extractedBytes, static_cast<int>(extractedBytes.size()), messageKey, messageKey, finalMessageBytes) < 0) {
-            std::cerr << "Error:    unable to decrypt extracted file" << std::endl;
+        int jobs = threads;
+        if (!parseIntOption(options, "--jobs", 1, 256, jobs) || !parsePngOptions(options, rstegOptions)) {
             return 1;
         }
+        rstegOptions.jobs = jobs;
+        rstegOptions.verbose = false;
+        // every connection runs a batch of one, each of the --jobs slots plans within its share
+        if (rstegOptions.maxMemory != 0) {
+            rstegOptions.maxMemory = std::max(1ULL, rstegOptions.maxMemory / static_cast<unsigned int>(jobs));
+        }
 
-        std::vector<unsigned char> slicedData(finalMessageBytes.begin(), finalMessageBytes.begin() + 4);
+        unsigned char messageKey[RSTEG_KEY_SIZE];
+        unsigned char seedKey[RSTEG_KEY_SIZE];
+        if (rstegReadKeyFile(messageKeyFile, messageKey) != RSTEG_OK || rstegReadKeyFile(seedKeyFile, seedKey) != RSTEG_OK) {
+            return -1;
+        }
 
-        std::string ext = getFileExtension(slicedData);
+        Rsteg rsteg(rstegOptions);
+        return serve(options["--socket"].c_str(), rsteg, messageKey, seedKey, static_cast<unsigned int>(jobs));
 
-        std::ofstream outputFile(outputFilename+ext, std::ios::binary);
+    } else if (strcmp(argv[1], "client") == 0) {
 
-        i = finalMessageBytes.size()-1;
+        RstegJob job;
+        job.mode = strcmp(argv[2], "enc") == 0 ? RSTEG_JOB_EMBED : RSTEG_JOB_EXTRACT;
+        job.container = argv[++index[0]];
+        if (job.mode == RSTEG_JOB_EMBED) {
+            job.payload = argv[++index[2]];
+            bool isVideo = job.container.size() >= 4 && job.container.compare(job.container.size() - 4, 4, ".avi") == 0;
+            job.output = index[1] == -1 ? (isVideo ? "out.avi" : "out.png") : argv[++index[1]];
+        } else {
+            job.output = index[1] == -1 ? "." : argv[++index[1]];
+        }
 
-        // remove any padding
-        while(true) {
-            if(finalMessageBytes[i] == 0x00) {
-                finalMessageBytes.pop_back();
-            } else {
-                break;
-            }
-            --i;
+        return runClient(options["--socket"].c_str(), job);
+
+    } else if (strcmp(argv[1], "probe") == 0) {
+
+        bool json = options.count("--json") > 0;
+        bool failed = false;
+        for (int i : index) {
+            failed = !printProbe(argv[i + 1], json) || failed;
         }
 
-        if (outputFile.is_open()) {
-            outputFile.write(reinterpret_cast<const char*>(finalMessageBytes.data()), finalMessageBytes.size());
-            outputFile.close();
-            std::cout << "reconstructed the file:   " << outputFilename+ext << std::endl;
-        } else {
-            return false;
+        if (failed) {
+            return 1;
         }
 
     } else {
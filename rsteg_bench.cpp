@@ -0,0 +1,348 @@
+// rsteg_bench : per stage timings on synthetic containers and payloads.
+//
+// Stages call the header-only helpers directly, end-to-end runs go through the
+// linked librsteg and take the exact code path of the CLI.
+#include <iomanip>
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <thread>
+#include <cstdio>
+#include "librsteg.hpp"
+#include "io_helpers.hpp"
+#include "lsb_rand.hpp"
+#include "aes_helpers.hpp"
+
+struct BenchConfig {
+    int width = 1920;
+    int height = 1080;
+    int frames = 30;
+    unsigned long long payload = 1ULL << 20;
+    unsigned long long legacyPositions = 1ULL << 22;
+    int iterations = 10;
+    unsigned int threads = 1;
+    int bits = LSB_DEFAULT_BITS;
+    std::string dir = ".";
+    std::string stage;
+    bool json = false;
+};
+
+struct BenchResult {
+    std::string name;
+    unsigned long long bytes;
+    std::vector<double> seconds;
+};
+
+// nearest rank percentile of sorted samples
+double percentile(const std::vector<double>& sorted, double p) {
+    size_t rank = static_cast<size_t>(p / 100.0 * sorted.size() + 0.5);
+    return sorted[std::min(sorted.size() - 1, rank == 0 ? 0 : rank - 1)];
+}
+
+class Bench {
+public:
+    explicit Bench(const BenchConfig& config) : config(config) {}
+
+    // one untimed warm-up run, then config.iterations timed runs of fn
+    template <typename Fn>
+    bool run(const std::string& name, unsigned long long bytes, Fn fn) {
+        if (!config.stage.empty() && name.find(config.stage) == std::string::npos) {
+            return true;
+        }
+
+        BenchResult result = {name, bytes, {}};
+        if (!fn()) {
+            std::cerr << "Error:    stage " << name << " failed" << std::endl;
+            return false;
+        }
+
+        for (int i = 0; i < config.iterations; ++i) {
+            auto start = std::chrono::steady_clock::now();
+            bool ok = fn();
+            auto stop = std::chrono::steady_clock::now();
+
+            if (!ok) {
+                std::cerr << "Error:    stage " << name << " failed" << std::endl;
+                return false;
+            }
+            result.seconds.push_back(std::chrono::duration<double>(stop - start).count());
+        }
+
+        std::sort(result.seconds.begin(), result.seconds.end());
+        report(result);
+
+        return true;
+    }
+
+private:
+    const BenchConfig& config;
+    bool header = false;
+
+    void report(const BenchResult& result) {
+        const std::vector<double>& s = result.seconds;
+        double mbps = static_cast<double>(result.bytes) / (1024.0 * 1024.0) / std::max(1e-9, percentile(s, 50));
+
+        if (config.json) {
+            std::cout << std::fixed << std::setprecision(3)
+                      << "{\"stage\":\"" << result.name << "\",\"bytes\":" << result.bytes
+                      << ",\"iterations\":" << s.size() << ",\"threads\":" << config.threads
+                      << ",\"min_ms\":" << s.front() * 1e3 << ",\"p50_ms\":" << percentile(s, 50) * 1e3
+                      << ",\"p90_ms\":" << percentile(s, 90) * 1e3 << ",\"p99_ms\":" << percentile(s, 99) * 1e3
+                      << ",\"max_ms\":" << s.back() * 1e3 << ",\"mb_per_s\":" << mbps << "}" << std::endl;
+            return;
+        }
+
+        if (!header) {
+            std::cout << std::left << std::setw(18) << "stage" << std::right << std::setw(12) << "MB"
+                      << std::setw(11) << "min ms" << std::setw(11) << "p50 ms" << std::setw(11) << "p90 ms"
+                      << std::setw(11) << "p99 ms" << std::setw(11) << "max ms" << std::setw(11) << "MB/s" << std::endl;
+            header = true;
+        }
+
+        std::cout << std::fixed << std::setprecision(2) << std::left << std::setw(18) << result.name << std::right
+                  << std::setw(12) << static_cast<double>(result.bytes) / (1024.0 * 1024.0)
+                  << std::setw(11) << s.front() * 1e3 << std::setw(11) << percentile(s, 50) * 1e3
+                  << std::setw(11) << percentile(s, 90) * 1e3 << std::setw(11) << percentile(s, 99) * 1e3
+                  << std::setw(11) << s.back() * 1e3 << std::setw(11) << mbps << std::endl;
+    }
+};
+
+// smooth gradient plus low bit noise, compresses roughly like a photograph
+std::vector<unsigned char> syntheticPixels(int width, int height, int channels, int frames, std::mt19937_64& rng) {
+    std::vector<unsigned char> pixels(static_cast<size_t>(width) * height * channels * frames);
+    size_t i = 0;
+
+    for (int f = 0; f < frames; ++f) {
+        for (int y = 0; y < height; ++y) {
+            for (int x = 0; x < width; ++x) {
+                unsigned long long noise = rng();
+                for (int c = 0; c < channels; ++c) {
+                    pixels[i++] = static_cast<unsigned char>((x + y + f * 8 + c * 64) / 4 + ((noise >> (c * 8)) & 0x0F));
+                }
+            }
+        }
+    }
+
+    return pixels;
+}
+
+bool writeFile(const std::string& path, const std::vector<unsigned char>& bytes) {
+    OutputFile file;
+    return file.open(path.c_str()) && file.writeAt(bytes.data(), bytes.size(), 0) && file.close();
+}
+
+bool parseBenchArgs(int argc, char** argv, BenchConfig& config) {
+    std::map<std::string, std::string> values;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--json") {
+            config.json = true;
+            continue;
+        }
+        if (arg == "--help" || arg.rfind("--", 0) != 0 || i + 1 >= argc) {
+            std::cerr << "usage: rsteg_bench\n" << std::endl;
+            std::cerr << "          --width N       [ container width, default 1920 ]" << std::endl;
+            std::cerr << "          --height N      [ container height, default 1080 ]" << std::endl;
+            std::cerr << "          --frames N      [ AVI frames, default 30 ]" << std::endl;
+            std::cerr << "          --payload N     [ payload bytes, default 1048576 ]" << std::endl;
+            std::cerr << "          --positions N   [ legacy / shuffle stage positions, default 4194304 ]" << std::endl;
+            std::cerr << "          --iterations N  [ timed runs per stage, default 10 ]" << std::endl;
+            std::cerr << "          --threads N     [ worker threads, default cores ]" << std::endl;
+            std::cerr << "          --bits N        [ LSB depth 1 - 4, default 2 ]" << std::endl;
+            std::cerr << "          --dir PATH      [ scratch directory, default . ]" << std::endl;
+            std::cerr << "          --stage NAME    [ only stages containing NAME ]" << std::endl;
+            std::cerr << "          --json          [ one JSON object per stage ]" << std::endl;
+            return false;
+        }
+        values[arg] = argv[++i];
+    }
+
+    auto number = [&](const char* name, unsigned long long minValue, unsigned long long& value) {
+        auto it = values.find(name);
+        if (it == values.end()) {
+            return true;
+        }
+        char* end = nullptr;
+        unsigned long long parsed = strtoull(it->second.c_str(), &end, 10);
+        if (it->second.empty() || *end != '\0' || parsed < minValue) {
+            std::cerr << "Error:    " << name << " expects a number >= " << minValue << std::endl;
+            return false;
+        }
+        value = parsed;
+        return true;
+    };
+
+    unsigned long long width = config.width, height = config.height, frames = config.frames;
+    unsigned long long iterations = config.iterations, threads = config.threads, bits = config.bits;
+    if (!number("--width", 1, width) || !number("--height", 1, height) || !number("--frames", 1, frames) ||
+        !number("--payload", 1, config.payload) || !number("--positions", 4, config.legacyPositions) ||
+        !number("--iterations", 1, iterations) || !number("--threads", 1, threads) ||
+        !number("--bits", LSB_MIN_BITS, bits)) {
+        return false;
+    }
+    if (bits > LSB_MAX_BITS) {
+        std::cerr << "Error:    --bits expects a value in [ 1 - 4 ]" << std::endl;
+        return false;
+    }
+
+    config.width = static_cast<int>(width);
+    config.height = static_cast<int>(height);
+    config.frames = static_cast<int>(frames);
+    config.iterations = static_cast<int>(iterations);
+    config.threads = static_cast<unsigned int>(std::min(256ULL, threads));
+    config.bits = static_cast<int>(bits);
+    config.legacyPositions -= config.legacyPositions % 4;
+    if (values.count("--dir")) {
+        config.dir = values["--dir"];
+    }
+    if (values.count("--stage")) {
+        config.stage = values["--stage"];
+    }
+
+    unsigned long long pngBytes = static_cast<unsigned long long>(config.width) * config.height * 3;
+    if (positionsForPayload(config.payload, config.bits) > pngBytes || config.legacyPositions > pngBytes) {
+        std::cerr << "Error:    payload and positions must fit a " << config.width << "x" << config.height << " RGB container" << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+int main(int argc, char** argv) {
+    BenchConfig config;
+    config.threads = std::min(256u, std::max(1u, std::thread::hardware_concurrency()));
+    if (!parseBenchArgs(argc, argv, config)) {
+        return 1;
+    }
+
+    std::mt19937_64 rng(0x5EED);
+    ThreadPool pool(config.threads);
+
+    const int channels = 3;
+    std::vector<unsigned char> pixels = syntheticPixels(config.width, config.height, channels, 1, rng);
+    std::vector<unsigned char> frames = syntheticPixels(config.width, config.height, channels, config.frames, rng);
+
+    std::vector<unsigned char> payload(config.payload);
+    for (auto& byte : payload) {
+        byte = static_cast<unsigned char>(rng());
+    }
+
+    unsigned char messageKey[RSTEG_KEY_SIZE];
+    unsigned char seedKey[RSTEG_KEY_SIZE];
+    unsigned char iv[AES_BLOCK_SIZE];
+    RAND_bytes(messageKey, sizeof(messageKey));
+    RAND_bytes(seedKey, sizeof(seedKey));
+    RAND_bytes(iv, sizeof(iv));
+
+    std::string pngPath = config.dir + "/rsteg_bench.png";
+    std::string aviPath = config.dir + "/rsteg_bench.avi";
+    std::string payloadPath = config.dir + "/rsteg_bench.bin";
+    std::string stegoPngPath = config.dir + "/rsteg_bench_out.png";
+    std::string stegoAviPath = config.dir + "/rsteg_bench_out.avi";
+    std::string extractBase = config.dir + "/rsteg_bench_extract";
+
+    if (!writeFile(payloadPath, payload) ||
+        !writeImage(pngPath.c_str(), pixels, config.width, config.height, channels) ||
+        !writeVideo(aviPath.c_str(), frames, config.width, config.height, channels)) {
+        std::cerr << "Error:    unable to write synthetic containers to " << config.dir << std::endl;
+        return 1;
+    }
+
+    PngWriteOptions pngOptions;
+    pngOptions.pool = &pool;
+
+    RstegOptions options;
+    options.threads = config.threads;
+    options.bits = config.bits;
+    Rsteg rsteg(options);
+
+    Bench bench(config);
+    std::pair<std::vector<int>, std::vector<unsigned char>> image;
+    unsigned long long seed = rng();
+    bool ok = true;
+
+    // container I/O
+    ok = ok && bench.run("write_png", pixels.size(), [&] {
+        return writeImage(pngPath.c_str(), pixels, config.width, config.height, channels, pngOptions);
+    });
+    ok = ok && bench.run("read_png", pixels.size(), [&] {
+        return readImage(pngPath.c_str(), image);
+    });
+    ok = ok && bench.run("write_avi", frames.size(), [&] {
+        return writeVideo(aviPath.c_str(), frames, config.width, config.height, channels);
+    });
+    ok = ok && bench.run("read_avi", frames.size(), [&] {
+        return readVideo(aviPath.c_str(), image);
+    });
+
+    // embed order, carrier bytes covered
+    std::vector<int> legacyPositions;
+    ok = ok && bench.run("positions_legacy", config.legacyPositions, [&] {
+        legacyPositions = generateRandomPositions(seed, config.legacyPositions);
+        return legacyPositions.size() == config.legacyPositions;
+    });
+    ShuffledPermutation shuffled;
+    ok = ok && bench.run("positions_shuffle", config.legacyPositions, [&] {
+        shuffled.build(seed, config.legacyPositions, pool);
+        return shuffled.size() == config.legacyPositions;
+    });
+
+    // LSB kernels, carrier bytes touched
+    std::vector<unsigned char> carrier(pixels);
+    std::vector<unsigned char> extracted(payload.size());
+    KeyedPermutation positions = generateKeyedPositions(seed, positionsForPayload(payload.size(), config.bits));
+    ok = ok && bench.run("encode_lsb", positions.size(), [&] {
+        encode_lsb_parallel(carrier.data(), carrier.size(), 0, payload, positions, pool, config.bits);
+        return true;
+    });
+    ok = ok && bench.run("decode_lsb", positions.size(), [&] {
+        std::fill(extracted.begin(), extracted.end(), 0);
+        decode_lsb_parallel(carrier.data(), carrier.size(), 0, positions, extracted, pool, config.bits);
+        return extracted == payload;
+    });
+    ok = ok && bench.run("decode_file", config.legacyPositions, [&] {
+        if (legacyPositions.empty()) {
+            legacyPositions = generateRandomPositions(seed, config.legacyPositions);
+        }
+        return decode_file_parallel(carrier.data(), legacyPositions, pool).size() == config.legacyPositions / 4;
+    });
+
+    // payload ciphers, payload bytes
+    std::vector<unsigned char> plaintext(payload);
+    std::vector<unsigned char> ciphertext;
+    std::vector<unsigned char> decrypted(payload.size() + AES_BLOCK_SIZE);
+    encrypt(plaintext, plaintext.size(), messageKey, messageKey, ciphertext);
+    ok = ok && bench.run("encrypt_cbc", payload.size(), [&] {
+        return encrypt(plaintext, plaintext.size(), messageKey, messageKey, ciphertext) >= 0;
+    });
+    ok = ok && bench.run("decrypt_cbc", payload.size(), [&] {
+        return decrypt(ciphertext, ciphertext.size(), messageKey, messageKey, decrypted) >= 0;
+    });
+    ok = ok && bench.run("crypt_ctr", payload.size(), [&] {
+        return ctr_crypt(payload.data(), payload.size(), messageKey, iv, extracted.data(), pool);
+    });
+
+    // end to end through the library, payload bytes
+    std::string outputPath;
+    ok = ok && bench.run("enc_png", payload.size(), [&] {
+        return rsteg.embedFile(pngPath.c_str(), payloadPath.c_str(), stegoPngPath.c_str(), messageKey, seedKey) == RSTEG_OK;
+    });
+    ok = ok && bench.run("dec_png", payload.size(), [&] {
+        return rsteg.extractFile(stegoPngPath.c_str(), extractBase, messageKey, seedKey, outputPath) == RSTEG_OK;
+    });
+    ok = ok && bench.run("enc_avi", payload.size(), [&] {
+        return rsteg.embedFile(aviPath.c_str(), payloadPath.c_str(), stegoAviPath.c_str(), messageKey, seedKey) == RSTEG_OK;
+    });
+    ok = ok && bench.run("dec_avi", payload.size(), [&] {
+        return rsteg.extractFile(stegoAviPath.c_str(), extractBase, messageKey, seedKey, outputPath) == RSTEG_OK;
+    });
+
+    for (const std::string& path : {pngPath, aviPath, payloadPath, stegoPngPath, stegoAviPath, outputPath}) {
+        if (!path.empty()) {
+            std::remove(path.c_str());
+        }
+    }
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,290 @@
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <cstring>
+#include <cerrno>
+#include <csignal>
+#include "librsteg.hpp"
+
+#ifndef _WIN32
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+// Local daemon for enc / dec jobs. `rsteg serve` loads the keys, OpenSSL and the
+// worker pool once and answers on a Unix domain socket, `rsteg client` sends it
+// one job per connection. Requests are manifest JSONL lines ( see batch_helpers.hpp )
+// with absolute paths, each reply is the job's batch summary line. Include after
+// batch_helpers.hpp.
+
+#ifndef _WIN32
+
+volatile sig_atomic_t serveStopping = 0;
+
+void stopServing(int) {
+    serveStopping = 1;
+}
+
+bool socketAddress(const char* path, sockaddr_un& address) {
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(address.sun_path)) {
+        std::cerr << "Error:    socket path too long " << path << std::endl;
+        return false;
+    }
+    strcpy(address.sun_path, path);
+
+    return true;
+}
+
+bool sendAll(int fd, const std::string& data) {
+    size_t sent = 0;
+    while (sent < data.size()) {
+        ssize_t n = send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        sent += static_cast<size_t>(n);
+    }
+
+    return true;
+}
+
+// next '\n' terminated line, `buffer` keeps what was read past it
+bool receiveLine(int fd, std::string& buffer, std::string& line) {
+    size_t end;
+    while ((end = buffer.find('\n')) == std::string::npos) {
+        char chunk[4096];
+        ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        buffer.append(chunk, static_cast<size_t>(n));
+    }
+
+    line = buffer.substr(0, end);
+    buffer.erase(0, end + 1);
+
+    return true;
+}
+
+// the daemon runs from another working directory
+std::string absolutePath(const std::string& path) {
+    if (!path.empty() && path[0] == '/') {
+        return path;
+    }
+
+    std::vector<char> cwd(4096);
+    if (getcwd(cwd.data(), cwd.size()) == nullptr) {
+        return path;
+    }
+
+    return std::string(cwd.data()) + "/" + path;
+}
+
+// Accept until SIGINT / SIGTERM. Connections are served on their own threads
+// sharing `rsteg`, lines are answered in order and at most `jobs` jobs run at
+// once; shutdown waits for open jobs.
+int serve(const char* socketPath, const Rsteg& rsteg, const unsigned char* messageKey, const unsigned char* seedKey,
+          unsigned int jobs) {
+    sockaddr_un address;
+    if (!socketAddress(socketPath, address)) {
+        return 1;
+    }
+
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0) {
+        std::cerr << "Error:    unable to create socket" << std::endl;
+        return 1;
+    }
+
+    // a socket file nobody answers on is left over from a daemon that died
+    if (connect(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0) {
+        std::cerr << "Error:    already serving on " << socketPath << std::endl;
+        close(listener);
+        return 1;
+    }
+    close(listener);
+
+    // never remove anything but a socket
+    struct stat st;
+    if (lstat(socketPath, &st) == 0) {
+        if (!S_ISSOCK(st.st_mode)) {
+            std::cerr << "Error:    " << socketPath << " exists and is not a socket" << std::endl;
+            return 1;
+        }
+        unlink(socketPath);
+    }
+
+    // the keys stay in this process, only the owner may connect
+    listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    mode_t previousMask = umask(0077);
+    bool bound = listener >= 0 && bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0;
+    umask(previousMask);
+    if (!bound || listen(listener, 64) != 0) {
+        std::cerr << "Error:    unable to listen on " << socketPath << std::endl;
+        if (listener >= 0) {
+            close(listener);
+        }
+        return 1;
+    }
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = stopServing;
+    sigaction(SIGINT, &action, nullptr);
+    sigaction(SIGTERM, &action, nullptr);
+
+    std::cout << "serving on " << socketPath << std::endl;
+
+    std::mutex mutex;
+    std::condition_variable idle, slotFree;
+    unsigned int active = 0;
+    unsigned int running = 0;
+    unsigned long long served = 0;
+
+    while (!serveStopping) {
+        int connection = accept(listener, nullptr, nullptr);
+        if (connection < 0) {
+            if (errno != EINTR) {
+                std::cerr << "Error:    accept failed, " << strerror(errno) << std::endl;
+            }
+            continue;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            ++active;
+        }
+
+        std::thread([&, connection] {
+            std::string buffer, line;
+            while (receiveLine(connection, buffer, line)) {
+                RstegJob job;
+                std::vector<RstegJobResult> results(1);
+                if (!parseJobJson(line, job) || !jobComplete(job)) {
+                    results[0].status = RSTEG_ERR_ARGUMENT;
+                } else {
+                    {
+                        std::unique_lock<std::mutex> lock(mutex);
+                        slotFree.wait(lock, [&] { return running < std::max(1u, jobs); });
+                        ++running;
+                    }
+                    rsteg.batch({job}, messageKey, seedKey, results);
+                    {
+                        std::lock_guard<std::mutex> lock(mutex);
+                        --running;
+                    }
+                    slotFree.notify_one();
+                }
+
+                unsigned long long number;
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    number = ++served;
+                }
+
+                std::ostringstream reply;
+                writeJobResult(reply, number, job, results[0]);
+                if (!sendAll(connection, reply.str())) {
+                    break;
+                }
+            }
+            close(connection);
+
+            std::lock_guard<std::mutex> lock(mutex);
+            --active;
+            idle.notify_all();
+        }).detach();
+    }
+
+    close(listener);
+    unlink(socketPath);
+
+    std::unique_lock<std::mutex> lock(mutex);
+    idle.wait(lock, [&] { return active == 0; });
+    std::cout << "served " << served << " jobs" << std::endl;
+
+    return 0;
+}
+
+// One job over the daemon's socket, printed like the enc / dec CLI output.
+// Returns the exit code.
+int runClient(const char* socketPath, RstegJob job) {
+    sockaddr_un address;
+    if (!socketAddress(socketPath, address)) {
+        return 1;
+    }
+
+    int connection = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (connection < 0 || connect(connection, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) {
+        std::cerr << "Error:    no rsteg daemon on " << socketPath << std::endl;
+        if (connection >= 0) {
+            close(connection);
+        }
+        return 1;
+    }
+
+    job.container = absolutePath(job.container);
+    job.output = absolutePath(job.output);
+    if (job.mode == RSTEG_JOB_EMBED) {
+        job.payload = absolutePath(job.payload);
+    }
+
+    std::ostringstream request;
+    request << "{\"mode\":\"" << (job.mode == RSTEG_JOB_EMBED ? "enc" : "dec") << "\""
+            << ",\"input\":\"" << jsonEscape(job.container) << "\""
+            << ",\"embed\":\"" << jsonEscape(job.payload) << "\""
+            << ",\"output\":\"" << jsonEscape(job.output) << "\"}\n";
+
+    std::string buffer, line;
+    std::map<std::string, std::string> reply;
+    bool answered = sendAll(connection, request.str()) && receiveLine(connection, buffer, line) && parseJsonLine(line, reply);
+    close(connection);
+
+    if (!answered) {
+        std::cerr << "Error:    no reply from the rsteg daemon" << std::endl;
+        return 1;
+    }
+
+    if (reply["ok"] != "true") {
+        std::cerr << "Error:    " << reply["error"] << std::endl;
+        return 1;
+    }
+
+    if (job.mode == RSTEG_JOB_EMBED) {
+        std::cout << "successfully created embedded container:      " << reply["output"] << std::endl;
+    } else {
+        std::cout << "reconstructed the file:   " << reply["output"] << std::endl;
+    }
+
+    return 0;
+}
+
+#else
+
+int serve(const char*, const Rsteg&, const unsigned char*, const unsigned char*, unsigned int) {
+    std::cerr << "Error:    rsteg serve needs Unix domain sockets" << std::endl;
+    return 1;
+}
+
+int runClient(const char*, RstegJob) {
+    std::cerr << "Error:    rsteg client needs Unix domain sockets" << std::endl;
+    return 1;
+}
+
+#endif
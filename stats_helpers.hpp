@@ -0,0 +1,97 @@
+#pragma once
+
+#include <chrono>
+
+// Per stage wall time and byte counters behind --stats. Stage boundaries run on
+// the thread that called into the library ( parallel sections are joined before
+// they return ), so timers record into a thread_local sink that is only set while
+// a caller asked for statistics. The video reader and writer threads fill sinks
+// of their own that are added to the caller's once joined.
+
+enum PipelineStage {
+    STAGE_CONTAINER_READ,
+    STAGE_KEY_LOAD,
+    STAGE_SEED,
+    STAGE_POSITIONS,
+    STAGE_ENCRYPT,
+    STAGE_EMBED,
+    STAGE_CONTAINER_WRITE,
+    STAGE_TRAILER_WRITE,
+    STAGE_TRAILER_READ,
+    STAGE_EXTRACT,
+    STAGE_DECRYPT,
+    STAGE_OUTPUT_WRITE,
+    STAGE_COMPRESS,
+    STAGE_DECOMPRESS,
+    STAGE_COUNT
+};
+
+struct StageStats {
+    unsigned long long ns[STAGE_COUNT] = {};
+    unsigned long long bytes[STAGE_COUNT] = {};
+};
+
+inline void addStageStats(StageStats& total, const StageStats& stats) {
+    for (int stage = 0; stage < STAGE_COUNT; ++stage) {
+        total.ns[stage] += stats.ns[stage];
+        total.bytes[stage] += stats.bytes[stage];
+    }
+}
+
+inline thread_local StageStats* activeStageStats = nullptr;
+
+// adds its lifetime to `stage` of the active sink, no-op without one
+class StageTimer {
+public:
+    explicit StageTimer(PipelineStage stage, unsigned long long bytes = 0) : stage(stage), bytes(bytes) {
+        if (activeStageStats != nullptr) {
+            start = std::chrono::steady_clock::now();
+        }
+    }
+
+    ~StageTimer() {
+        stop();
+    }
+
+    // bytes only known once the stage has run
+    void count(unsigned long long moreBytes) {
+        bytes += moreBytes;
+    }
+
+    // record now instead of at scope exit
+    void stop() {
+        if (activeStageStats != nullptr && !stopped) {
+            auto elapsed = std::chrono::steady_clock::now() - start;
+            activeStageStats->ns[stage] += std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+            activeStageStats->bytes[stage] += bytes;
+        }
+        stopped = true;
+    }
+
+    StageTimer(const StageTimer&) = delete;
+    StageTimer& operator=(const StageTimer&) = delete;
+
+private:
+    PipelineStage stage;
+    unsigned long long bytes;
+    bool stopped = false;
+    std::chrono::steady_clock::time_point start;
+};
+
+// installs `stats` as the calling thread's sink for the current scope
+class StageScope {
+public:
+    explicit StageScope(StageStats* stats) : previous(activeStageStats) {
+        activeStageStats = stats;
+    }
+
+    ~StageScope() {
+        activeStageStats = previous;
+    }
+
+    StageScope(const StageScope&) = delete;
+    StageScope& operator=(const StageScope&) = delete;
+
+private:
+    StageStats* previous;
+};
@@ -0,0 +1,147 @@
+#pragma once
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <atomic>
+#include <deque>
+#include <vector>
+#include <algorithm>
+
+// Fixed size worker pool. Threads waiting on a parallelFor help drain the queue,
+// so calls may nest and a pool of size 1 runs everything inline on the caller.
+class ThreadPool {
+public:
+    explicit ThreadPool(unsigned int threads) : numThreads(std::max(1u, threads)) {
+        for (unsigned int i = 1; i < numThreads; ++i) {
+            workers.emplace_back([this] { workerLoop(); });
+        }
+    }
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto& worker : workers) {
+            worker.join();
+        }
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    unsigned int size() const { return numThreads; }
+
+    void submit(std::function<void()> task) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            tasks.push_back(std::move(task));
+        }
+        wake.notify_one();
+    }
+
+    // run fn(begin, end) over contiguous chunks of [0, total), at least `grain` long,
+    // and return once every chunk has finished
+    void parallelFor(unsigned long long total, unsigned long long grain,
+                     const std::function<void(unsigned long long, unsigned long long)>& fn) {
+        grain = std::max(1ULL, grain);
+        unsigned long long chunks = std::min<unsigned long long>(total / grain, 4ULL * numThreads);
+
+        if (numThreads == 1 || chunks <= 1) {
+            if (total > 0) {
+                fn(0, total);
+            }
+            return;
+        }
+
+        unsigned long long step = (total + chunks - 1) / chunks;
+        std::atomic<unsigned long long> remaining((total + step - 1) / step);
+
+        for (unsigned long long begin = 0; begin < total; begin += step) {
+            unsigned long long end = std::min(total, begin + step);
+            submit([&, begin, end] {
+                fn(begin, end);
+                if (remaining.fetch_sub(1) == 1) {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    finished.notify_all();
+                }
+            });
+        }
+
+        while (remaining.load() > 0) {
+            if (!runOne()) {
+                std::unique_lock<std::mutex> lock(mutex);
+                finished.wait(lock, [&] { return remaining.load() == 0 || !tasks.empty(); });
+            }
+        }
+    }
+
+private:
+    unsigned int numThreads;
+    std::vector<std::thread> workers;
+    std::deque<std::function<void()>> tasks;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable finished;
+    bool stopping = false;
+
+    bool runOne() {
+        std::function<void()> task;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (tasks.empty()) {
+                return false;
+            }
+            task = std::move(tasks.front());
+            tasks.pop_front();
+        }
+        task();
+        return true;
+    }
+
+    void workerLoop() {
+        while (true) {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [this] { return stopping || !tasks.empty(); });
+                if (tasks.empty()) {
+                    return;
+                }
+                task = std::move(tasks.front());
+                tasks.pop_front();
+            }
+            task();
+        }
+    }
+};
+
+// Unbounded FIFO between pipeline threads. Pipelines bound it by circulating a
+// fixed set of buffers, so pop blocks a stage that ran ahead of its producer.
+template <typename T>
+class BlockingQueue {
+public:
+    void push(T value) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            items.push_back(std::move(value));
+        }
+        ready.notify_one();
+    }
+
+    T pop() {
+        std::unique_lock<std::mutex> lock(mutex);
+        ready.wait(lock, [this] { return !items.empty(); });
+        T value = std::move(items.front());
+        items.pop_front();
+        return value;
+    }
+
+private:
+    std::deque<T> items;
+    std::mutex mutex;
+    std::condition_variable ready;
+};